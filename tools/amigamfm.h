@@ -1,6 +1,8 @@
 #ifndef _AMIGAMFM_H_
 #define _AMIGAMFM_H_
 
+#include "mfm.h"
+
 /*
 
 From : http://lclevy.free.fr/adflib/adf_info.html
@@ -114,12 +116,33 @@ A DD disk has 11*2*80=1760 (0 to 1759) blocks, a HD disk has 22*2*80=3520 blocks
 #define AMIGA_UNKNOWN 0
 #define AMIGA_DOS_FORMAT 1
 
+struct ModContext;
+
+// Amiga MFM parser state, one per track being decoded
+typedef struct AmigaMFMContext
+{
+  int state; // state machine
+  unsigned int datacells; // 16 bit sliding buffer
+  int bits; // Number of used bits within sliding buffer
+  unsigned int p1, p2, p3; // bit history
+
+  unsigned long blockpos;
+
+  // Output block data buffer, for a single sector
+  unsigned char bitstream[MFM_BLOCKSIZE];
+  unsigned int bitlen;
+
+  // MFM timings
+  float defaultwindow;
+  float bucket01, bucket001, bucket0001;
+} AmigaMFM_Context;
+
 extern void amigamfm_showinfo(const unsigned int disktracks, const int debug);
 
-extern int amigamfm_validate();
+extern int amigamfm_validate(const int debug);
 
-extern void amigamfm_addsample(const unsigned long samples, const unsigned long datapos);
+extern void amigamfm_addsample(struct ModContext *ctx, const unsigned long samples, const unsigned long datapos);
 
-extern void amigamfm_init(const int debug, const char density);
+extern void amigamfm_init(struct ModContext *ctx, const char density);
 
 #endif
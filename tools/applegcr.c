@@ -4,6 +4,7 @@
 
 #include "hardware.h"
 #include "diskstore.h"
+#include "mod.h"
 #include "applegcr.h"
 
 // GCR for Apple II
@@ -49,20 +50,6 @@
 //    E          8          7         A
 //    F          F          F         5
 
-int applegcr_state=APPLEGCR_IDLE; // state machine
-uint32_t applegcr_datacells; // 32 bit sliding buffer
-int applegcr_bits=0; // Number of used bits within sliding buffer
-float applegcr_defaultwindow; // Number of samples in window
-float applegcr_threshold01; // Number of samples for an 01
-float applegcr_threshold001; // Number of samples for an 001
-
-// Most recent address mark
-unsigned long applegcr_idpos, applegcr_blockpos;
-int applegcr_idamtrack, applegcr_idamsector; // IDAM values
-int applegcr_lasttrack, applegcr_lastsector; // last known good IDAM values
-unsigned int applegcr_idblockcrc, applegcr_datablockcrc;
-
-unsigned int applegcr_datamode;
 const uint8_t applegcr_gcr53encodemap[]=
 {
   0xab, 0xad, 0xae, 0xaf, 0xb5, 0xb6, 0xb7, 0xba, // 0x00
@@ -86,13 +73,6 @@ unsigned char applegcr_gcr62decodemap[0x100];
 
 const uint8_t applegcr_bit_reverse[] = {0, 2, 1, 3};
 
-unsigned char applegcr_bytebuff[1024];
-unsigned int applegcr_bytelen;
-
-unsigned char applegcr_decodebuff[1024];
-
-int applegcr_debug=0;
-
 void applegcr_buildgcrdecodemaps()
 {
   unsigned int i;
@@ -135,37 +115,38 @@ unsigned char applegcr_calc_eor(unsigned char *buff, unsigned int len)
 // * the first 86 bytes of the encoded sector are used to keep the lowest two bits of all bytes;
 // * the remaining portions of six bits fill the final 256 on-disk bytes of the sector;
 // * an exclusive OR checksum is used, but to reduce decoding time it is applied within the six-bit data
-void applegcr_process_data62()
+void applegcr_process_data62(Mod_Context *ctx, const unsigned long datapos)
 {
+  AppleGCR_Context *apple=&ctx->applegcr;
   int i;
   unsigned char buff[512];
   unsigned char value;
   unsigned char cx;
 
   bzero(buff, sizeof(buff));
-  bzero(applegcr_decodebuff, sizeof(applegcr_decodebuff));
+  bzero(apple->decodebuff, sizeof(apple->decodebuff));
 
   // Convert 342+1 disk bytes into 342+1 6-bit GCR
   for (i=0; i<(342+1); i++)
-    applegcr_decodebuff[i]=applegcr_gcr62decodemap[applegcr_bytebuff[i]];
+    apple->decodebuff[i]=applegcr_gcr62decodemap[apple->bytebuff[i]];
 
   // XOR 342+1 GCR bytes to undo checksum process
   for (i=0; i<(342+1); i++)
   {
     if (i==0)
-      applegcr_decodebuff[i]^=0;
+      apple->decodebuff[i]^=0;
     else
-      applegcr_decodebuff[i]^=applegcr_decodebuff[i-1];
+      apple->decodebuff[i]^=apple->decodebuff[i-1];
   }
 
-  cx=applegcr_decodebuff[342];
+  cx=apple->decodebuff[342];
 
   if (cx==0)
   {
     // Recombine bits
     for (i=0; i<86; i++)
     {
-      value=applegcr_decodebuff[i];
+      value=apple->decodebuff[i];
 
       if (i<84)
         buff[i+172]|=applegcr_bit_reverse[(value>>4) & 0x3];
@@ -175,20 +156,20 @@ void applegcr_process_data62()
     }
 
     for (i=86; i<(342+1); i++)
-      buff[i-86]|=(applegcr_decodebuff[i]<<2);
+      buff[i-86]|=(apple->decodebuff[i]<<2);
 
     // Check we have an ID
-    if ((applegcr_idamtrack!=-1) && (applegcr_idamsector!=-1))
+    if ((apple->idamtrack!=-1) && (apple->idamsector!=-1))
     {
-      diskstore_addsector(MODAPPLEGCR, hw_currenttrack, hw_currenthead, applegcr_idamtrack, hw_currenthead, applegcr_idamsector, 1, applegcr_idpos, applegcr_idblockcrc, applegcr_blockpos, applegcr_datamode, APPLEGCR_SECTORLEN, &buff[0], applegcr_decodebuff[342]);
+      ctx->addsector(ctx, MODAPPLEGCR, apple->idamtrack, ctx->head, apple->idamsector, 1, apple->idpos, apple->idblockcrc, apple->blockpos, datapos, apple->datamode, APPLEGCR_SECTORLEN, &buff[0], apple->decodebuff[342]);
     }
     else
     {
-      if (applegcr_debug)
+      if (ctx->debug)
       {
         fprintf(stderr, "** VALID DATA BUT INVALID ID");
-        if ((applegcr_lasttrack!=-1) && (applegcr_lastsector!=-1))
-          fprintf(stderr, ", last found ID was T%d S%d", applegcr_lasttrack, applegcr_lastsector);
+        if ((apple->lasttrack!=-1) && (apple->lastsector!=-1))
+          fprintf(stderr, ", last found ID was T%d S%d", apple->lasttrack, apple->lastsector);
 
         fprintf(stderr, " **\n");
       }
@@ -196,19 +177,19 @@ void applegcr_process_data62()
   }
   else
   {
-    if (applegcr_debug)
+    if (ctx->debug)
     {
-      fprintf(stderr, "** INVALID DATA EORSUM [%.2x] (%.2x)", applegcr_decodebuff[341], applegcr_decodebuff[342]);
-      if ((applegcr_idamtrack!=-1) && (applegcr_idamsector!=-1))
-        fprintf(stderr, ", possibly for T%d S%d", applegcr_idamtrack, applegcr_idamsector);
+      fprintf(stderr, "** INVALID DATA EORSUM [%.2x] (%.2x)", apple->decodebuff[341], apple->decodebuff[342]);
+      if ((apple->idamtrack!=-1) && (apple->idamsector!=-1))
+        fprintf(stderr, ", possibly for T%d S%d", apple->idamtrack, apple->idamsector);
 
       fprintf(stderr, " **\n");
     }
   }
 
   // Clear IDAM cache
-  applegcr_idamtrack=-1;
-  applegcr_idamsector=-1;
+  apple->idamtrack=-1;
+  apple->idamsector=-1;
 }
 
 // Process data block stored using 5 data bits, 3 extra bits per byte format
@@ -216,80 +197,82 @@ void applegcr_process_data53()
 {
 }
 
-void applegcr_addbit(const unsigned char bit, const unsigned long datapos)
+void applegcr_addbit(Mod_Context *ctx, const unsigned char bit, const unsigned long datapos)
 {
-  applegcr_datacells=(applegcr_datacells<<1)|bit;
-  applegcr_bits++;
+  AppleGCR_Context *apple=&ctx->applegcr;
+
+  apple->datacells=(apple->datacells<<1)|bit;
+  apple->bits++;
 
-  switch (applegcr_state)
+  switch (apple->state)
   {
     case APPLEGCR_IDLE:
-      if (applegcr_bits>=24)
+      if (apple->bits>=24)
       {
-        switch (applegcr_datacells&0xffffff)
+        switch (apple->datacells&0xffffff)
         {
           case 0xd5aab5: // Address field / DOS 3.2
-            if (applegcr_debug)
-              fprintf(stderr, "[%lx] Found a [%.2X] D5 AA B5, DOS 3.2 (5/3) ID\n", datapos, (applegcr_datacells&0xff000000)>>24);
+            if (ctx->debug)
+              fprintf(stderr, "[%lx] Found a [%.2X] D5 AA B5, DOS 3.2 (5/3) ID\n", datapos, (apple->datacells&0xff000000)>>24);
 
-            applegcr_datamode=APPLEGCR_DATA_53;
-            applegcr_state=APPLEGCR_ID;
-            applegcr_bytelen=0; applegcr_bits=0;
+            apple->datamode=APPLEGCR_DATA_53;
+            apple->state=APPLEGCR_ID;
+            apple->bytelen=0; apple->bits=0;
 
-            applegcr_idpos=datapos;
+            apple->idpos=datapos;
 
             // Clear IDAM cache
-            applegcr_idamtrack=-1;
-            applegcr_idamsector=-1;
+            apple->idamtrack=-1;
+            apple->idamsector=-1;
             break;
 
           case 0xd5aa96: // Address field / DOS 3.3
-            if (applegcr_debug)
-              fprintf(stderr, "[%lx] Found a [%.2X] D5 AA 96, DOS 3.3 (6/2) ID\n", datapos, (applegcr_datacells&0xff000000)>>24);
+            if (ctx->debug)
+              fprintf(stderr, "[%lx] Found a [%.2X] D5 AA 96, DOS 3.3 (6/2) ID\n", datapos, (apple->datacells&0xff000000)>>24);
 
-            applegcr_datamode=APPLEGCR_DATA_62;
-            applegcr_state=APPLEGCR_ID;
-            applegcr_bytelen=0; applegcr_bits=0;
+            apple->datamode=APPLEGCR_DATA_62;
+            apple->state=APPLEGCR_ID;
+            apple->bytelen=0; apple->bits=0;
 
-            applegcr_idpos=datapos;
+            apple->idpos=datapos;
 
             // Clear IDAM cache
-            applegcr_idamtrack=-1;
-            applegcr_idamsector=-1;
+            apple->idamtrack=-1;
+            apple->idamsector=-1;
             break;
 
           case 0xd5aaad: // Data field / 342+1 bytes encoded as 6 and 2
-            if (applegcr_debug)
-              fprintf(stderr, "[%lx] Found a [%.2X] D5 AA AD, DATA\n", datapos, (applegcr_datacells&0xff000000)>>24);
+            if (ctx->debug)
+              fprintf(stderr, "[%lx] Found a [%.2X] D5 AA AD, DATA\n", datapos, (apple->datacells&0xff000000)>>24);
 
-            applegcr_state=APPLEGCR_DATA;
-            applegcr_bytelen=0; applegcr_bits=0;
+            apple->state=APPLEGCR_DATA;
+            apple->bytelen=0; apple->bits=0;
 
-            applegcr_blockpos=datapos;
+            apple->blockpos=datapos;
             break;
 
           case 0xdeaaeb: // Epilogue
-            if (applegcr_debug)
+            if (ctx->debug)
               fprintf(stderr, "[%lx] Found a DE AA EB, EPILOGUE\n", datapos);
             break;
 
           case 0xd4aab7: // Address field / 13 sector / non-standard
-            if (applegcr_debug)
-              fprintf(stderr, "[%lx] Found a [%.2X] D4 AA B7, non-standard ID\n", datapos, (applegcr_datacells&0xff000000)>>24);
+            if (ctx->debug)
+              fprintf(stderr, "[%lx] Found a [%.2X] D4 AA B7, non-standard ID\n", datapos, (apple->datacells&0xff000000)>>24);
             break;
 
           case 0xd4aa96: // Address field / 16 sector / non-standard
-            if (applegcr_debug)
-              fprintf(stderr, "[%lx] Found a [%.2X] D4 AA 96, non-standard ID\n", datapos, (applegcr_datacells&0xff000000)>>24);
+            if (ctx->debug)
+              fprintf(stderr, "[%lx] Found a [%.2X] D4 AA 96, non-standard ID\n", datapos, (apple->datacells&0xff000000)>>24);
             break;
 
           case 0xd5bbcf: // Data field non-standard
-            if (applegcr_debug)
-              fprintf(stderr, "[%lx] Found a [%.2X] D5 BB CF, non-standard DATA\n", datapos, (applegcr_datacells&0xff000000)>>24);
+            if (ctx->debug)
+              fprintf(stderr, "[%lx] Found a [%.2X] D5 BB CF, non-standard DATA\n", datapos, (apple->datacells&0xff000000)>>24);
             break;
 
           case 0xdaaaeb: // Epilogue non-standard
-            if (applegcr_debug)
+            if (ctx->debug)
               fprintf(stderr, "[%lx] Found a DA AA EB, non-standard EPILOGUE\n", datapos);
             break;
 
@@ -307,42 +290,42 @@ void applegcr_addbit(const unsigned char bit, const unsigned long datapos)
       // SUM SUM - Checksum (XOR of previous 6 bytes comprising volume/track/sector)
       // DE AA EB - Epilogue
 
-      if (applegcr_bits==8)
+      if (apple->bits==8)
       {
-        applegcr_bytebuff[applegcr_bytelen++]=applegcr_datacells&0xff;
-        applegcr_bits=0;
+        apple->bytebuff[apple->bytelen++]=apple->datacells&0xff;
+        apple->bits=0;
       }
 
-      if (applegcr_bytelen>=8)
+      if (apple->bytelen>=8)
       {
-        if (applegcr_debug)
+        if (ctx->debug)
         {
-          fprintf(stderr, " Vol : %d", applegcr_decode4and4(applegcr_bytebuff[0], applegcr_bytebuff[1])); // Defaults to 254
-          fprintf(stderr, " Trk : %d", applegcr_decode4and4(applegcr_bytebuff[2], applegcr_bytebuff[3]));
-          fprintf(stderr, " Sct : %d", applegcr_decode4and4(applegcr_bytebuff[4], applegcr_bytebuff[5]));
-          fprintf(stderr, " Sum : %d", applegcr_decode4and4(applegcr_bytebuff[6], applegcr_bytebuff[7]));
-          fprintf(stderr, " EOR : %d\n", applegcr_calc_eor(&applegcr_bytebuff[0], 6));
+          fprintf(stderr, " Vol : %d", applegcr_decode4and4(apple->bytebuff[0], apple->bytebuff[1])); // Defaults to 254
+          fprintf(stderr, " Trk : %d", applegcr_decode4and4(apple->bytebuff[2], apple->bytebuff[3]));
+          fprintf(stderr, " Sct : %d", applegcr_decode4and4(apple->bytebuff[4], apple->bytebuff[5]));
+          fprintf(stderr, " Sum : %d", applegcr_decode4and4(apple->bytebuff[6], apple->bytebuff[7]));
+          fprintf(stderr, " EOR : %d\n", applegcr_calc_eor(&apple->bytebuff[0], 6));
         }
 
-        if (applegcr_decode4and4(applegcr_bytebuff[6], applegcr_bytebuff[7]) == applegcr_calc_eor(&applegcr_bytebuff[0], 6))
+        if (applegcr_decode4and4(apple->bytebuff[6], apple->bytebuff[7]) == applegcr_calc_eor(&apple->bytebuff[0], 6))
         {
-          applegcr_idamtrack=applegcr_decode4and4(applegcr_bytebuff[2], applegcr_bytebuff[3]);
-          applegcr_idamsector=applegcr_decode4and4(applegcr_bytebuff[4], applegcr_bytebuff[5]);
+          apple->idamtrack=applegcr_decode4and4(apple->bytebuff[2], apple->bytebuff[3]);
+          apple->idamsector=applegcr_decode4and4(apple->bytebuff[4], apple->bytebuff[5]);
 
           // Record last known good IDAM values for this track
-          applegcr_lasttrack=applegcr_idamtrack;
-          applegcr_lastsector=applegcr_idamsector;
+          apple->lasttrack=apple->idamtrack;
+          apple->lastsector=apple->idamsector;
 
-          applegcr_idblockcrc=applegcr_decode4and4(applegcr_bytebuff[6], applegcr_bytebuff[7]);
+          apple->idblockcrc=applegcr_decode4and4(apple->bytebuff[6], apple->bytebuff[7]);
         }
         else
         {
-          applegcr_idamtrack=-1;
-          applegcr_idamsector=-1;
+          apple->idamtrack=-1;
+          apple->idamsector=-1;
         }
 
-        applegcr_bits=0;
-        applegcr_state=APPLEGCR_IDLE;
+        apple->bits=0;
+        apple->state=APPLEGCR_IDLE;
       }
       break;
 
@@ -361,24 +344,24 @@ void applegcr_addbit(const unsigned char bit, const unsigned long datapos)
       // SUM - Checksum (XOR)
       // DE AA EB - Epilogue
 
-      if (applegcr_bits==8)
+      if (apple->bits==8)
       {
-        applegcr_bytebuff[applegcr_bytelen++]=applegcr_datacells&0xff;
-        applegcr_bits=0;
+        apple->bytebuff[apple->bytelen++]=apple->datacells&0xff;
+        apple->bits=0;
       }
 
-      if (applegcr_bytelen>=(applegcr_datamode+1))
+      if (apple->bytelen>=(apple->datamode+1))
       {
-        if (applegcr_debug)
-          fprintf(stderr, "Processing data block [%d]\n", applegcr_datamode);
+        if (ctx->debug)
+          fprintf(stderr, "Processing data block [%d]\n", apple->datamode);
 
-        if (applegcr_datamode==APPLEGCR_DATA_62)
-          applegcr_process_data62();
+        if (apple->datamode==APPLEGCR_DATA_62)
+          applegcr_process_data62(ctx, datapos);
         else
           applegcr_process_data53();
 
-        applegcr_bits=0;
-        applegcr_state=APPLEGCR_IDLE;
+        apple->bits=0;
+        apple->state=APPLEGCR_IDLE;
       }
 
       break;
@@ -388,46 +371,49 @@ void applegcr_addbit(const unsigned char bit, const unsigned long datapos)
   }
 
   // Limit bits used to 32
-  if (applegcr_bits>=32)
-    applegcr_bits=32;
+  if (apple->bits>=32)
+    apple->bits=32;
 }
 
-void applegcr_addsample(const unsigned long samples, const unsigned long datapos)
+void applegcr_addsample(Mod_Context *ctx, const unsigned long samples, const unsigned long datapos)
 {
+  AppleGCR_Context *apple=&ctx->applegcr;
+
   // 50,100,150
   //   4us, 8us and 12us
   //   1, 01, 001
 
-  if (samples>applegcr_threshold001)
-    applegcr_addbit(0, datapos);
+  if (samples>apple->threshold001)
+    applegcr_addbit(ctx, 0, datapos);
 
-  if (samples>applegcr_threshold01)
-    applegcr_addbit(0, datapos);
+  if (samples>apple->threshold01)
+    applegcr_addbit(ctx, 0, datapos);
 
-  applegcr_addbit(1, datapos);
+  applegcr_addbit(ctx, 1, datapos);
 }
 
-void applegcr_init(const int debug, const char density)
+void applegcr_init(Mod_Context *ctx, const char density)
 {
-  applegcr_debug=debug;
+  AppleGCR_Context *apple=&ctx->applegcr;
 
-  applegcr_defaultwindow=((float)hw_samplerate/(float)USINSECOND)*(float)APPLEGCR_BITCELL;
-  applegcr_threshold01=applegcr_defaultwindow*1.5;
-  applegcr_threshold001=applegcr_defaultwindow*2.5;
+  apple->defaultwindow=((float)ctx->samplerate/(float)USINSECOND)*(float)APPLEGCR_BITCELL;
+  apple->threshold01=apple->defaultwindow*1.5;
+  apple->threshold001=apple->defaultwindow*2.5;
 
   // Set up Apple GCR parser
-  applegcr_state=APPLEGCR_IDLE;
-
-  applegcr_buildgcrdecodemaps();
+  apple->state=APPLEGCR_IDLE;
+  apple->datacells=0;
+  apple->bits=0;
+  apple->bytelen=0;
 
-  applegcr_idpos=0;
-  applegcr_blockpos=0;
+  apple->idpos=0;
+  apple->blockpos=0;
 
   // Initialise last found sector IDAM to invalid
-  applegcr_idamtrack=-1;
-  applegcr_idamsector=-1;
+  apple->idamtrack=-1;
+  apple->idamsector=-1;
 
   // Initialise last known good sector IDAM to invalid
-  applegcr_lasttrack=-1;
-  applegcr_lastsector=-1;
+  apple->lasttrack=-1;
+  apple->lastsector=-1;
 }
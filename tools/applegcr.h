@@ -1,6 +1,8 @@
 #ifndef _APPLEGCR_H_
 #define _APPLEGCR_H_
 
+#include <stdint.h>
+
 // State machine
 #define APPLEGCR_IDLE 0
 #define APPLEGCR_ID 1
@@ -14,11 +16,36 @@
 
 #define APPLEGCR_BITCELL 4
 
-extern int applegcr_idamtrack, applegcr_idamsector;
-extern int applegcr_lasttrack, applegcr_lastsector;
+struct ModContext;
+
+// Apple GCR parser state, one per track being decoded
+typedef struct AppleGCRContext
+{
+  int state; // state machine
+  uint32_t datacells; // 32 bit sliding buffer
+  int bits; // Number of used bits within sliding buffer
+  float defaultwindow; // Number of samples in window
+  float threshold01; // Number of samples for an 01
+  float threshold001; // Number of samples for an 001
+
+  // Most recent address mark
+  unsigned long idpos, blockpos;
+  int idamtrack, idamsector; // IDAM values
+  int lasttrack, lastsector; // last known good IDAM values
+  unsigned int idblockcrc, datablockcrc;
+
+  unsigned int datamode;
+
+  unsigned char bytebuff[1024];
+  unsigned int bytelen;
+
+  unsigned char decodebuff[1024];
+} AppleGCR_Context;
+
+extern void applegcr_addsample(struct ModContext *ctx, const unsigned long samples, const unsigned long datapos);
 
-extern void applegcr_addsample(const unsigned long samples, const unsigned long datapos);
+extern void applegcr_init(struct ModContext *ctx, const char density);
 
-extern void applegcr_init(const int debug, const char density);
+extern void applegcr_buildgcrdecodemaps();
 
 #endif
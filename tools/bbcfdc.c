@@ -21,6 +21,11 @@
 #include "fm.h"
 #include "mfm.h"
 #include "gcr.h"
+#include "pipeline.h"
+#ifdef NOPI
+#include "pool.h"
+#include "cache.h"
+#endif
 
 // For type of capture
 #define DISKNONE 0
@@ -50,6 +55,12 @@
 // Number of rotations to cature per track
 #define ROTATIONS 3
 
+// Tracks kept in the diskstore when streaming, as filesystem detection looks at them
+#define STREAMKEEPTRACKS 2
+
+// Chunks to capture per rotation, after the first rotation, when decoding as samples arrive
+#define CHUNKSPERROTATION 4
+
 int debug=0;
 int summary=0;
 int catalogue=0;
@@ -59,7 +70,6 @@ int capturetype=DISKNONE; // Default to no output
 int outputtype=IMAGENONE; // Default to no image
 
 unsigned char *samplebuffer=NULL;
-unsigned char *flippybuffer=NULL;
 unsigned long samplebuffsize;
 int flippy=0;
 int info=0;
@@ -77,46 +87,185 @@ FILE *csvhandle=NULL;
 int sectorspertrack=AUTODETECT;
 unsigned int totalsectors=0;
 
-// Used for reversing bit order within a byte
-static unsigned char revlookup[16] = {0x0, 0x8, 0x4, 0xc, 0x2, 0xa, 0x6, 0xe, 0x1, 0x9, 0x5, 0xd, 0x3, 0xb, 0x7, 0xf};
-unsigned char reverse(unsigned char n)
+#ifdef NOPI
+// Decode the current track straight from its run lengths, when held as them in the sample file, returns 1 if decoded
+//   nothing needs to be captured, so chunks are decoded here rather than whilst the next is captured, and every rotation is decoded
+int capturerletrack()
 {
-   // Reverse the top and bottom nibble then swap them.
-   return (revlookup[n&0x0f]<<4) | revlookup[n>>4];
+  const unsigned char *rledata;
+  unsigned long rlelen, filled, captured, rotation;
+
+  rotation=(hw_samplerate/HW_ROTATIONSPERSEC)/BITSPERBYTE;
+
+  // Start with a whole rotation, so there is enough flux to find the density
+  filled=hw_samplerletrackchunk(&rledata, &rlelen, samplebuffsize, 0, rotation);
+  if (filled==0)
+    return 0;
+
+  mod_startrlestream(rledata, rlelen, samplebuffsize, hw_currenttrack, hw_currenthead);
+
+  while (1)
+  {
+    if (!mod_streamsamples(rledata, filled))
+      break;
+
+    if (filled>=samplebuffsize)
+      break;
+
+    captured=hw_samplerletrackchunk(&rledata, &rlelen, samplebuffsize, filled, rotation/CHUNKSPERROTATION);
+    if (captured<=filled)
+      break;
+
+    filled=captured;
+  }
+
+  mod_endstream();
+
+  return 1;
 }
+#endif
 
-// Used for flipping the bits in a raw sample buffer
-void fillflippybuffer(const unsigned char *rawdata, const unsigned long rawlen)
+// Capture the current track and decode it, a chunk at a time so capture can stop once all the expected sectors are found
+void capturetrack(const int pipelined, const int attempt, const unsigned char *expected)
 {
-  if (flippybuffer==NULL)
-    flippybuffer=malloc(rawlen);
+  unsigned long filled, captured, rotation, capturesize;
+  int complete, spi;
+
+  // Samples from the reverse side of a flippy disk are read backwards, so can only be decoded once the whole track has been captured
+  if ((flippy!=0) && (hw_currenthead!=0))
+  {
+    hw_samplerawtrackdata((char *)samplebuffer, samplebuffsize);
+
+    if (pipelined)
+    {
+      pipeline_decode(samplebuffer, samplebuffsize, MOD_SAMPLESREVERSE, hw_currenttrack, hw_currenthead, attempt, NULL);
+      pipeline_addsamples(samplebuffsize);
+      pipeline_finish();
+    }
+    else
+      mod_processtrack(samplebuffer, samplebuffsize, MOD_SAMPLESREVERSE, hw_currenttrack, hw_currenthead, attempt);
+
+    return;
+  }
+
+#ifdef NOPI
+  // Tracks held as run lengths don't need expanding into samples
+  if ((!hw_spisamples) && (capturerletrack()))
+    return;
+#endif
+
+  rotation=(hw_samplerate/HW_ROTATIONSPERSEC)/BITSPERBYTE;
+
+  // Samples are decoded as they were sampled by SPI, where each byte takes 9 samples, so less of the buffer covers the same time
+  spi=hw_spisamples;
+  capturesize=spi?(((samplebuffsize+BITSPERBYTE)/(BITSPERBYTE+1))*BITSPERBYTE):samplebuffsize;
+
+  if (pipelined)
+    pipeline_decode(samplebuffer, samplebuffsize, spi?MOD_SAMPLESSPI:0, hw_currenttrack, hw_currenthead, attempt, expected);
+  else
+    mod_startstream(samplebuffsize, hw_currenttrack, hw_currenthead, spi?MOD_SAMPLESSPI:0);
+
+  // Start with a whole rotation, so there is enough flux to find the density
+  filled=hw_samplespitrackchunk((char *)samplebuffer, capturesize, 0, rotation);
 
-  if (flippybuffer!=NULL)
+  while (1)
   {
-    unsigned long em;
+    if (pipelined)
+    {
+      // Chunk is decoded whilst the next one is captured, so this only knows about the chunks before
+      pipeline_addsamples(filled);
+      complete=pipeline_complete();
+    }
+    else
+    {
+      if (!mod_streamsamples(samplebuffer, filled))
+        break;
 
-    for (em=0; em<rawlen; em++)
-      flippybuffer[rawlen-em]=reverse(rawdata[em]);
+      complete=((expected!=NULL) && (diskstore_hassectormap(hw_currenttrack, hw_currenthead, expected)));
+    }
+
+    if ((complete) || (filled>=capturesize))
+      break;
+
+    captured=hw_samplespitrackchunk((char *)samplebuffer, capturesize, filled, rotation/CHUNKSPERROTATION);
+    if (captured<=filled)
+      break;
+
+    filled=captured;
   }
+
+  if (pipelined)
+    pipeline_finish();
+  else
+    mod_endstream();
+}
+
+// Write one track of a DFS disk image from the diskstore, returns the number of sectors missing
+int writedfstrack(const unsigned int track)
+{
+  Disk_Sector *sec;
+  unsigned char blanksector[DFS_SECTORSIZE];
+  int imgside, j, missing;
+
+  // Prepare a blank sector when no sector is found in store
+  bzero(blanksector, sizeof(blanksector));
+
+  missing=0;
+
+  for (imgside=0; imgside<sides; imgside++)
+  {
+    for (j=0; j<sectorspertrack; j++)
+    {
+      // Write
+      sec=diskstore_findhybridsector(track, sidetoread!=-1?sidetoread:imgside, j);
+
+      if ((sec!=NULL) && (sec->data!=NULL))
+      {
+        fwrite(sec->data, 1, DFS_SECTORSIZE, diskimage);
+      }
+      else
+      {
+        fwrite(blanksector, 1, DFS_SECTORSIZE, diskimage);
+        missing++;
+      }
+    }
+  }
+
+  return missing;
+}
+
+// Determine which decoders found sector IDs on the last processed track
+int founddecoders()
+{
+  int decoders=0;
+
+  if ((mod_context.fm.lasttrack!=-1) || (mod_context.fm.lasthead!=-1) || (mod_context.fm.lastsector!=-1) || (mod_context.fm.lastlength!=-1))
+    decoders|=MOD_DECODEFM;
+
+  // Amiga MFM shares the MFM IDAM values
+  if ((mod_context.mfm.lasttrack!=-1) || (mod_context.mfm.lasthead!=-1) || (mod_context.mfm.lastsector!=-1) || (mod_context.mfm.lastlength!=-1))
+    decoders|=(MOD_DECODEMFM|MOD_DECODEAMIGAMFM);
+
+  if ((mod_context.gcr.lasttrack!=-1) || (mod_context.gcr.lastsector!=-1))
+    decoders|=MOD_DECODEGCR;
+
+  if ((mod_context.applegcr.lasttrack!=-1) || (mod_context.applegcr.lastsector!=-1))
+    decoders|=MOD_DECODEAPPLEGCR;
+
+  return decoders;
 }
 
 // Stop the motor and tidy up upon exit
 void exitFunction()
 {
   printf("Exit function\n");
-  hw_done();
 
-  if (samplebuffer!=NULL)
-  {
-    free(samplebuffer);
-    samplebuffer=NULL;
-  }
+  // Capture buffers are freed by the hardware layer
+  samplebuffer=NULL;
 
-  if (flippybuffer!=NULL)
-  {
-    free(flippybuffer);
-    flippybuffer=NULL;
-  }
+  hw_done();
+
+  mod_freeflux(&mod_flux);
 }
 
 // Handle signals by stopping motor and tidying up
@@ -134,9 +283,9 @@ void showargs(const char *exename)
   fprintf(stderr, "%s - Floppy disk raw flux capture and processor\n\n", exename);
   fprintf(stderr, "Syntax : ");
 #ifdef NOPI
-  fprintf(stderr, "[-i input_rfi_file] ");
+  fprintf(stderr, "[-i input_rfi_file] [-threads threads] [-rotdelay milliseconds] [-cache] ");
 #endif
-  fprintf(stderr, "[[-c] | [-o output_file]] [-spidiv spi_divider] [[-ss]|[-ds]] [-r retries] [-sort] [-sectors sectors_per_track] [-summary] [-csv] [-tmax maxtracks] [-l] [-title \"Title\"] [-v]\n");
+  fprintf(stderr, "[[-c] | [-o output_file]] [-spidiv spi_divider] [[-ss]|[-ds]] [-r retries] [-sort] [-stream] [-sectors sectors_per_track] [-summary] [-alldecoders] [-nopipeline] [-csv] [-tmax maxtracks] [-l] [-title \"Title\"] [-v]\n");
 }
 
 int main(int argc,char **argv)
@@ -145,11 +294,23 @@ int main(int argc,char **argv)
   unsigned int i, j, rate;
   unsigned char retry, retries, side, drivestatus;
   int sortsectors=0;
+  int streaming=0;
+  unsigned int streamtrack=0, streamwritten=0;
   int missingsectors=0;
   int csv=0;
+  int alldecoders=0;
+  int probedecoders=0;
   char modulation=AUTODETECT;
+  int pipelined=1;
+  unsigned char expectedmap[DISKSTORE_SECTORMAPSIZE];
+  const unsigned char *expected;
+  unsigned int mostsectors=0;
 #ifdef NOPI
   char *samplefile;
+  int threads=1;
+  int pooled=0;
+  int usecache=0;
+  int cached=0;
 #endif
   char *outputfilename=NULL;
   char title[100];
@@ -214,11 +375,26 @@ int main(int argc,char **argv)
       sortsectors=1;
     }
     else
+    if (strcmp(argv[argn], "-stream")==0)
+    {
+      streaming=1;
+    }
+    else
     if (strcmp(argv[argn], "-summary")==0)
     {
       summary=1;
     }
     else
+    if (strcmp(argv[argn], "-alldecoders")==0)
+    {
+      alldecoders=1;
+    }
+    else
+    if (strcmp(argv[argn], "-nopipeline")==0)
+    {
+      pipelined=0;
+    }
+    else
     if ((strcmp(argv[argn], "-sectors")==0) && ((argn+1)<argc))
     {
       int retval;
@@ -482,11 +658,43 @@ int main(int argc,char **argv)
       samplefile=argv[argn];
 
     }
+    else
+    if ((strcmp(argv[argn], "-threads")==0) && ((argn+1)<argc))
+    {
+      int retval;
+
+      ++argn;
+
+      if ((sscanf(argv[argn], "%3d", &retval)==1) && (retval>0))
+        threads=retval;
+    }
+    else
+    if ((strcmp(argv[argn], "-rotdelay")==0) && ((argn+1)<argc))
+    {
+      int retval;
+
+      ++argn;
+
+      if ((sscanf(argv[argn], "%5d", &retval)==1) && (retval>=0))
+        hw_rotationdelay=retval;
+    }
+    else
+    if (strcmp(argv[argn], "-cache")==0)
+    {
+      usecache=1;
+    }
 #endif
 
     ++argn;
   }
 
+  // Only DFS images have a layout which is known before the whole disk has been read
+  if ((streaming) && (outputtype!=IMAGESSD) && (outputtype!=IMAGEDSD) && (outputtype!=IMAGESDD) && (outputtype!=IMAGEDDD))
+  {
+    printf("Streaming is only supported for .ssd, .dsd, .sdd and .ddd images\n");
+    streaming=0;
+  }
+
   // Create a csv file with the same name as the output file
   // but with a .csv extension
   if ((csv!=0) && (outputfilename!=NULL))
@@ -525,6 +733,15 @@ int main(int argc,char **argv)
 
   diskstore_init();
 
+  // Sector images only need one good copy of each sector, other outputs (and the cache) keep them all
+  if ((outputtype==IMAGESSD) || (outputtype==IMAGEDSD) || (outputtype==IMAGESDD) || (outputtype==IMAGEDDD) || (outputtype==IMAGEIMG))
+    mod_skipheld=1;
+
+#ifdef NOPI
+  if (usecache)
+    mod_skipheld=0;
+#endif
+
   mod_init(debug);
 
 #ifndef NOPI
@@ -545,7 +762,7 @@ int main(int argc,char **argv)
 
   // Allocate memory for SPI buffer
   samplebuffsize=((hw_samplerate/HW_ROTATIONSPERSEC)/BITSPERBYTE)*ROTATIONS;
-  samplebuffer=malloc(samplebuffsize);
+  samplebuffer=(unsigned char *)hw_acquirebuffer(samplebuffsize);
   if (samplebuffer==NULL)
   {
     fprintf(stderr, "\n");
@@ -613,24 +830,25 @@ int main(int argc,char **argv)
   // Sample track
   hw_samplerawtrackdata((char *)samplebuffer, samplebuffsize);
   mod_process(samplebuffer, samplebuffsize, 99);
+  probedecoders=founddecoders();
 
   // Check readability
-  if ((fm_lasttrack==-1) && (fm_lasthead==-1) && (fm_lastsector==-1) && (fm_lastlength==-1))
+  if ((mod_context.fm.lasttrack==-1) && (mod_context.fm.lasthead==-1) && (mod_context.fm.lastsector==-1) && (mod_context.fm.lastlength==-1))
     printf("No FM sector IDs found\n");
   else
     modulation=MODFM;
 
-  if ((mfm_lasttrack==-1) && (mfm_lasthead==-1) && (mfm_lastsector==-1) && (mfm_lastlength==-1))
+  if ((mod_context.mfm.lasttrack==-1) && (mod_context.mfm.lasthead==-1) && (mod_context.mfm.lastsector==-1) && (mod_context.mfm.lastlength==-1))
     printf("No MFM sector IDs found\n");
   else
     modulation=MODMFM;
 
-  if ((gcr_lasttrack==-1) && (gcr_lastsector==-1))
+  if ((mod_context.gcr.lasttrack==-1) && (mod_context.gcr.lastsector==-1))
     printf("No C64 GCR sector IDs found\n");
   else
     modulation=MODGCR;
 
-  if ((applegcr_lasttrack==-1) && (applegcr_lastsector==-1))
+  if ((mod_context.applegcr.lasttrack==-1) && (mod_context.applegcr.lastsector==-1))
     printf("No Apple GCR sector IDs found\n");
   else
     modulation=MODAPPLEGCR;
@@ -642,33 +860,33 @@ int main(int argc,char **argv)
     int othersector;
 
     // Check if it was FM sectors found
-    if ((fm_lasttrack!=-1) && (fm_lasthead!=-1) && (fm_lastsector!=-1) && (fm_lastlength!=-1))
+    if ((mod_context.fm.lasttrack!=-1) && (mod_context.fm.lasthead!=-1) && (mod_context.fm.lastsector!=-1) && (mod_context.fm.lastlength!=-1))
     {
-      othertrack=fm_lasttrack;
-      otherhead=fm_lasthead;
-      othersector=fm_lastsector;
+      othertrack=mod_context.fm.lasttrack;
+      otherhead=mod_context.fm.lasthead;
+      othersector=mod_context.fm.lastsector;
     }
 
     // Check if it was MFM sectors found
-    if ((mfm_lasttrack!=-1) && (mfm_lasthead!=-1) && (mfm_lastsector!=-1) && (mfm_lastlength!=-1))
+    if ((mod_context.mfm.lasttrack!=-1) && (mod_context.mfm.lasthead!=-1) && (mod_context.mfm.lastsector!=-1) && (mod_context.mfm.lastlength!=-1))
     {
-      othertrack=mfm_lasttrack;
-      otherhead=mfm_lasthead;
-      othersector=mfm_lastsector;
+      othertrack=mod_context.mfm.lasttrack;
+      otherhead=mod_context.mfm.lasthead;
+      othersector=mod_context.mfm.lastsector;
     }
 
     // Check if it was C64 GCR sectors found
-    if ((gcr_lasttrack!=-1) && (gcr_lastsector!=-1))
+    if ((mod_context.gcr.lasttrack!=-1) && (mod_context.gcr.lastsector!=-1))
     {
-      othertrack=gcr_lasttrack;
-      othersector=gcr_lastsector;
+      othertrack=mod_context.gcr.lasttrack;
+      othersector=mod_context.gcr.lastsector;
     }
 
     // Check if it was Apple GCR sectors found
-    if ((applegcr_lasttrack!=-1) && (applegcr_lastsector!=-1))
+    if ((mod_context.applegcr.lasttrack!=-1) && (mod_context.applegcr.lastsector!=-1))
     {
-      othertrack=applegcr_lasttrack;
-      othersector=applegcr_lastsector;
+      othertrack=mod_context.applegcr.lasttrack;
+      othersector=mod_context.applegcr.lastsector;
     }
 
     // Only look for data on other side if user hasn't specified number of sides to capture
@@ -685,31 +903,31 @@ int main(int argc,char **argv)
       mod_process(samplebuffer, samplebuffsize, 99);
 
       // Check for flippy disk
-      if ((fm_lasttrack==-1) && (fm_lasthead==-1) && (fm_lastsector==-1) && (fm_lastlength==-1)
-         && (mfm_lasttrack==-1) && (mfm_lasthead==-1) && (mfm_lastsector==-1) && (mfm_lastlength==-1)
-         && (gcr_lasttrack==-1) && (gcr_lastsector==-1)
-         && (applegcr_lasttrack==-1) && (applegcr_lastsector==-1))
+      if ((mod_context.fm.lasttrack==-1) && (mod_context.fm.lasthead==-1) && (mod_context.fm.lastsector==-1) && (mod_context.fm.lastlength==-1)
+         && (mod_context.mfm.lasttrack==-1) && (mod_context.mfm.lasthead==-1) && (mod_context.mfm.lastsector==-1) && (mod_context.mfm.lastlength==-1)
+         && (mod_context.gcr.lasttrack==-1) && (mod_context.gcr.lastsector==-1)
+         && (mod_context.applegcr.lasttrack==-1) && (mod_context.applegcr.lastsector==-1))
       {
-        fillflippybuffer(samplebuffer, samplebuffsize);
+        // Try reading the samples backwards
+        mod_processtrack(samplebuffer, samplebuffsize, MOD_SAMPLESREVERSE, hw_currenttrack, hw_currenthead, 99);
 
-        if (flippybuffer!=NULL)
-          mod_process(flippybuffer, samplebuffsize, 99);
-
-        if ((fm_lasttrack!=-1) || (fm_lasthead!=-1) || (fm_lastsector!=-1) || (fm_lastlength!=-1)
-           || (mfm_lasttrack!=-1) || (mfm_lasthead!=-1) || (mfm_lastsector!=-1) || (mfm_lastlength!=-1)
-           || (gcr_lasttrack!=-1) || (gcr_lastsector!=-1)
-           || (applegcr_lasttrack!=-1) || (applegcr_lastsector!=-1))
+        if ((mod_context.fm.lasttrack!=-1) || (mod_context.fm.lasthead!=-1) || (mod_context.fm.lastsector!=-1) || (mod_context.fm.lastlength!=-1)
+           || (mod_context.mfm.lasttrack!=-1) || (mod_context.mfm.lasthead!=-1) || (mod_context.mfm.lastsector!=-1) || (mod_context.mfm.lastlength!=-1)
+           || (mod_context.gcr.lasttrack!=-1) || (mod_context.gcr.lastsector!=-1)
+           || (mod_context.applegcr.lasttrack!=-1) || (mod_context.applegcr.lastsector!=-1))
         {
           printf("Flippy disk detected\n");
           flippy=1;
         }
       }
 
+      probedecoders|=founddecoders();
+
       // Check readability
-      if ((fm_lasttrack==-1) && (fm_lasthead==-1) && (fm_lastsector==-1) && (fm_lastlength==-1)
-         && (mfm_lasttrack==-1) && (mfm_lasthead==-1) && (mfm_lastsector==-1) && (mfm_lastlength==-1)
-         && (gcr_lasttrack==-1) && (gcr_lastsector==-1)
-         && (applegcr_lasttrack==-1) && (applegcr_lastsector==-1))
+      if ((mod_context.fm.lasttrack==-1) && (mod_context.fm.lasthead==-1) && (mod_context.fm.lastsector==-1) && (mod_context.fm.lastlength==-1)
+         && (mod_context.mfm.lasttrack==-1) && (mod_context.mfm.lasthead==-1) && (mod_context.mfm.lastsector==-1) && (mod_context.mfm.lastlength==-1)
+         && (mod_context.gcr.lasttrack==-1) && (mod_context.gcr.lastsector==-1)
+         && (mod_context.applegcr.lasttrack==-1) && (mod_context.applegcr.lastsector==-1))
       {
         // Only lower side was readable
         printf("Single-sided disk assumed, only found data on side 0\n");
@@ -719,7 +937,7 @@ int main(int argc,char **argv)
       else
       {
         // If IDAM shows same head, then double-sided separate
-        if ((fm_lasthead==otherhead) || (mfm_lasthead==otherhead))
+        if ((mod_context.fm.lasthead==otherhead) || (mod_context.mfm.lasthead==otherhead))
           printf("Double-sided with separate sides disk detected\n");
         else
           printf("Double-sided disk detected\n");
@@ -769,6 +987,10 @@ int main(int argc,char **argv)
     sides=2;
   }
 
+  // Only run the decoders which found sector IDs when probing, unless told otherwise
+  if ((alldecoders==0) && (probedecoders!=0))
+    mod_decoders=probedecoders;
+
   // Write header when doing raw capture
   if (capturetype==DISKRAW)
   {
@@ -791,6 +1013,38 @@ int main(int argc,char **argv)
     }
   }
 
+#ifdef NOPI
+  // Reuse the sectors decoded from this input file on an earlier run
+  if ((usecache) && (capturetype!=DISKRAW))
+    cached=cache_open(samplefile, mod_decoders);
+  else
+    usecache=0;
+
+  // Read and decode tracks in parallel when converting to an image, they are still added to the diskstore in order
+  if ((threads>1) && (cached==0) && (capturetype==DISKIMG) && (flippy==0) && (sidetoread==-1) && ((drivetracks!=40) || (disktracks!=80)))
+  {
+    pooled=1;
+
+    for (i=0; i<(drivetracks/hw_stepping); i++)
+      for (side=0; side<sides; side++)
+        if (!pool_addtrack(i*hw_stepping, side))
+          pooled=0;
+
+    if ((pooled==0) || (pool_start(threads, samplebuffsize)==0))
+    {
+      pool_stop();
+      pooled=0;
+    }
+  }
+
+  if (pooled)
+    pipelined=0;
+#endif
+
+  // Decode each track on another thread whilst it is being captured
+  if ((pipelined) && ((capturetype!=DISKIMG) || (!pipeline_start())))
+    pipelined=0;
+
   // Start at track 0
   hw_seektotrackzero();
 
@@ -809,6 +1063,27 @@ int main(int argc,char **argv)
       // Select the correct side
       hw_sideselect(side);
 
+      // Stop capturing once every sector ID expected has been found, either those up to the number of sectors per track,
+      //   or those on the fullest track so far
+      expected=NULL;
+      if (sectorspertrack!=AUTODETECT)
+      {
+        bzero(expectedmap, sizeof(expectedmap));
+        for (j=0; j<(unsigned int)sectorspertrack; j++)
+          expectedmap[j/8]|=(1<<(j%8));
+
+        expected=expectedmap;
+      }
+      else
+      if (mostsectors>0)
+        expected=expectedmap;
+
+#ifdef NOPI
+      // Decode every rotation, as the pool does, so the sectors found don't depend on how the input is read
+      //   or on the output format when caching
+      expected=NULL;
+#endif
+
       // Retry the capture if any sectors are missing
       for (retry=0; retry<retries; retry++)
       {
@@ -818,23 +1093,23 @@ int main(int argc,char **argv)
         if (retry==0)
           printf("Sampling data for track %.2X head %.2x\n", i, side);
 
-        // Sampling data
-        hw_samplerawtrackdata((char *)samplebuffer, samplebuffsize);
+#ifdef NOPI
+        // Track was decoded on an earlier run
+        if ((cached) && (cache_loadtrack(hw_currenttrack, hw_currenthead)))
+          break;
 
-        // Process the raw sample data to extract FM encoded data
-        if (capturetype!=DISKRAW)
+        // Track has already been read and decoded by the pool
+        if (pooled)
         {
-          if ((flippy==0) || (side==0))
-          {
-            mod_process(samplebuffer, samplebuffsize, retry);
-          }
-          else
-          {
-            fillflippybuffer(samplebuffer, samplebuffsize);
+          pool_collect();
+          break;
+        }
+#endif
 
-            if (flippybuffer!=NULL)
-              mod_process(flippybuffer, samplebuffsize, retry);
-          }
+        // Sample and process the raw data to extract FM encoded data
+        if (capturetype!=DISKRAW)
+        {
+          capturetrack(pipelined, retry, expected);
 
 #ifdef NOPI
           // No point in retrying when not using real hardware
@@ -847,30 +1122,38 @@ int main(int argc,char **argv)
             break;
 	
           // See if we have successfully read a full track
-          int trackstatus=1;
-
-          for (j=0; j<sectorspertrack; j++)
-	  {
-            if (diskstore_findhybridsector(hw_currenttrack, hw_currenthead, j)==NULL)
-	    {
-              // Failed to read at least one track
-              trackstatus=0; 
-            }
-	  }
-
-	  if(trackstatus==1) break;
+          if (diskstore_hassectors(hw_currenttrack, hw_currenthead, sectorspertrack)) break;
 
           printf("Retry attempt %d, sectors ", retry+1);
           for (j=0; j<sectorspertrack; j++)
-            if (diskstore_findhybridsector(hw_currenttrack, hw_currenthead, j)==NULL) printf("%.2u ", j);
+            if (!diskstore_hassector(hw_currenttrack, hw_currenthead, j)) printf("%.2u ", j);
           printf("\n");
         }
         else
+        {
+          // Sampling data
+          hw_samplerawtrackdata((char *)samplebuffer, samplebuffsize);
+
           break; // No retries in RAW mode
+        }
       } // retry loop
 
       if (capturetype!=DISKRAW)
       {
+#ifdef NOPI
+        if (usecache)
+          cache_storetrack(hw_currenttrack, hw_currenthead);
+#endif
+
+        j=diskstore_countlogicalsectors(hw_currenttrack, hw_currenthead);
+        if (j>mostsectors)
+        {
+          mostsectors=j;
+
+          if (sectorspertrack==AUTODETECT)
+            diskstore_getsectormap(hw_currenttrack, hw_currenthead, expectedmap);
+        }
+
         // Check if catalogue has been done
         if ((info<sides) && (catalogue==1))
         {
@@ -947,7 +1230,7 @@ int main(int argc,char **argv)
               }
               else
               {
-                if (amigamfm_validate()!=AMIGA_UNKNOWN)
+                if (amigamfm_validate(debug)!=AMIGA_UNKNOWN)
                 {
                   printf("\nDetected Amiga DOS\n\n");
                   amigamfm_showinfo(disktracks, debug);
@@ -968,27 +1251,64 @@ int main(int argc,char **argv)
         // Write the raw sample data if required
         if (rawdata!=NULL)
         {
-          switch (outputtype)
+          if (mod_buildflux(&mod_flux, samplebuffer, samplebuffsize))
           {
-            case IMAGERAW:
-              rfi_writetrack(rawdata, i, side, hw_measurerpm(), "rle", samplebuffer, samplebuffsize);
-              break;
+            switch (outputtype)
+            {
+              case IMAGERAW:
+                rfi_writetrack(rawdata, i, side, hw_measurerpm(), "rle", samplebuffer, samplebuffsize, &mod_flux);
+                break;
+
+              case IMAGEDFI:
+                dfi_writetrack(rawdata, i, side, &mod_flux, ROTATIONS);
+                break;
 
-            case IMAGEDFI:
-              dfi_writetrack(rawdata, i, side, samplebuffer, samplebuffsize, ROTATIONS);
-              break;
+              case IMAGESCP:
+                scp_writetrack(rawdata, ((i/hw_stepping)*sides)+side, &mod_flux, ROTATIONS, hw_measurerpm());
+                break;
 
-            case IMAGESCP:
-              scp_writetrack(rawdata, ((i/hw_stepping)*sides)+side, samplebuffer, samplebuffsize, ROTATIONS, hw_measurerpm());
-              break;
+              default:
+                break;
+            }
+          }
+          else
+          {
+            fprintf(stderr, "Unable to allocate flux buffer\n");
 
-            default:
-              break;
+            // An RFI track can still be written as the samples, which don't need the flux
+            if (outputtype==IMAGERAW)
+              rfi_writetrack(rawdata, i, side, hw_measurerpm(), "raw", samplebuffer, samplebuffsize, NULL);
+            else
+              printf("Unable to write head %d track %u\n", hw_currenthead, i);
           }
         }
       }
     } // side loop
 
+    // Write out tracks as soon as they are complete, holding back blank tracks in case they are past the end of the disk
+    if (streaming)
+    {
+      for (; ((streamtrack<=hw_currenttrack) && (streamtrack<hw_maxtracks) && (streamtrack<disktracks)); streamtrack++)
+      {
+        if ((diskstore_countsectors(streamtrack, 0)==0) && (diskstore_countsectors(streamtrack, 1)==0))
+          continue;
+
+        for (; streamwritten<=streamtrack; streamwritten++)
+        {
+          missingsectors+=writedfstrack(streamwritten);
+
+          // Sector data is no longer needed once written
+          if (streamwritten>=STREAMKEEPTRACKS)
+          {
+            diskstore_releasetrack(streamwritten, 0);
+            diskstore_releasetrack(streamwritten, 1);
+          }
+        }
+      }
+
+      fflush(diskimage);
+    }
+
     // If we're only doing a catalogue, then don't read any more tracks
     if (capturetype==DISKCAT)
       break;
@@ -998,6 +1318,17 @@ int main(int argc,char **argv)
       break;
   } // track loop
 
+#ifdef NOPI
+  if (pooled)
+    pool_stop();
+
+  if (usecache)
+    cache_close();
+#endif
+
+  if (pipelined)
+    pipeline_stop();
+
   // Return the disk head to track 0 following disk imaging
   hw_seektotrackzero();
 
@@ -1086,34 +1417,9 @@ int main(int argc,char **argv)
     if ((outputtype==IMAGEDSD) || (outputtype==IMAGESSD) || 
         (outputtype==IMAGEDDD) || (outputtype==IMAGESDD))
     {
-      Disk_Sector *sec;
-      unsigned char blanksector[sectorspertrack];
-      int imgside;
-
-      // Prepare a blank sector when no sector is found in store
-      bzero(blanksector, sizeof(blanksector));
-
-      for (i=0; ((i<hw_maxtracks) && (i<disktracks)); i++)
-      {
-        for (imgside=0; imgside<sides; imgside++)
-        {
-          for (j=0; j<sectorspertrack; j++)
-          {
-            // Write
-            sec=diskstore_findhybridsector(i, sidetoread!=-1?sidetoread:imgside, j);
-
-            if ((sec!=NULL) && (sec->data!=NULL))
-            {
-              fwrite(sec->data, 1, DFS_SECTORSIZE, diskimage);
-            }
-            else
-            {
-              fwrite(blanksector, 1, DFS_SECTORSIZE, diskimage);
-              missingsectors++;
-            }
-          }
-        }
-      }
+      // When streaming, only the tracks not already written remain
+      for (i=streamwritten; ((i<hw_maxtracks) && (i<disktracks)); i++)
+        missingsectors+=writedfstrack(i);
     }
     else
     if (outputtype==IMAGEIMG)
@@ -1165,25 +1471,21 @@ int main(int argc,char **argv)
   {
     if (outputtype==IMAGESCP)
       scp_finalise(rawdata, (drivetracks/hw_stepping)*sides);
+
+    if (outputtype==IMAGERAW)
+      rfi_finalise(rawdata);
   }
 
   // Close disk image files (if open)
   if (diskimage!=NULL) fclose(diskimage);
   if (rawdata!=NULL) fclose(rawdata);
 
-  // Free memory allocated to SPI buffer
-  if (samplebuffer!=NULL)
-  {
-    free(samplebuffer);
-    samplebuffer=NULL;
-  }
+  // Release SPI buffer
+  hw_releasebuffer((char *)samplebuffer);
+  samplebuffer=NULL;
 
-  // Free any memory allocated to flippy buffer
-  if (flippybuffer!=NULL)
-  {
-    free(flippybuffer);
-    flippybuffer=NULL;
-  }
+  // Free memory allocated to flux runs
+  mod_freeflux(&mod_flux);
 
   // When writing csv, close file (if open)
   if((csv) && (csvhandle!=NULL))
@@ -1245,6 +1547,8 @@ int main(int argc,char **argv)
 
       printf("Total storage is %ld bytes\n", totalstorage);
     }
+
+    printf("Capture buffer allocations %lu\n", hw_allocations);
   }
 
   // Show a layout map of where data was found on disk surface
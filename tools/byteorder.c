@@ -0,0 +1,39 @@
+#include <stdio.h>
+#include <stdint.h>
+
+#include "byteorder.h"
+
+// Read little endian values
+uint16_t byteorder_get16(const unsigned char *data)
+{
+  return ((uint16_t)data[1]<<8) | data[0];
+}
+
+uint32_t byteorder_get32(const unsigned char *data)
+{
+  return ((uint32_t)byteorder_get16(&data[2])<<16) | byteorder_get16(data);
+}
+
+uint64_t byteorder_get64(const unsigned char *data)
+{
+  return ((uint64_t)byteorder_get32(&data[4])<<32) | byteorder_get32(data);
+}
+
+// Write little endian values
+void byteorder_put16(FILE *fh, const uint16_t value)
+{
+  fputc(value&0xff, fh);
+  fputc((value>>8)&0xff, fh);
+}
+
+void byteorder_put32(FILE *fh, const uint32_t value)
+{
+  byteorder_put16(fh, value&0xffff);
+  byteorder_put16(fh, (value>>16)&0xffff);
+}
+
+void byteorder_put64(FILE *fh, const uint64_t value)
+{
+  byteorder_put32(fh, value&0xffffffff);
+  byteorder_put32(fh, (value>>32)&0xffffffff);
+}
@@ -0,0 +1,17 @@
+#ifndef _BYTEORDER_H_
+#define _BYTEORDER_H_
+
+#include <stdint.h>
+#include <stdio.h>
+
+// Read little endian values
+extern uint16_t byteorder_get16(const unsigned char *data);
+extern uint32_t byteorder_get32(const unsigned char *data);
+extern uint64_t byteorder_get64(const unsigned char *data);
+
+// Write little endian values
+extern void byteorder_put16(FILE *fh, const uint16_t value);
+extern void byteorder_put32(FILE *fh, const uint32_t value);
+extern void byteorder_put64(FILE *fh, const uint64_t value);
+
+#endif
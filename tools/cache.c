@@ -0,0 +1,382 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "byteorder.h"
+#include "cache.h"
+#include "diskstore.h"
+#include "hardware.h"
+#include "mod.h"
+
+/*
+Sidecar cache of decoded sectors, so the same input file need not be decoded again
+
+All values are little endian
+
+Header:
+=======
+     Magic: "FDCCACHE" 8 bytes
+   Version: 2 bytes, CACHE_VERSION of the decoders which found the sectors
+  Decoders: 1 byte, decoders which were run
+      Size: 8 bytes, size of the input file
+      Hash: 8 bytes, FNV-1a hash of the input file
+
+Then records until the end record
+=================================
+ Type: 1 byte, 'T' for track or 'E' for end
+
+For each track
+==============
+    Track: 1 byte (physical)
+     Head: 1 byte (physical)
+  Density: 1 byte, densities detected up to and including this track
+    Count: 2 bytes, number of sectors
+
+  For each sector
+  ===============
+   Modulation: 1 byte
+     Track_ID: 1 byte
+  Head_number: 1 byte
+    Sector_ID: 1 byte
+  Sector_size: 1 byte
+       ID_pos: 4 bytes
+        IDCRC: 4 bytes
+     Data_pos: 4 bytes
+  Data_endpos: 4 bytes
+     Datatype: 4 bytes
+     Datasize: 4 bytes
+      DataCRC: 4 bytes
+         Data: <Datasize> bytes
+
+The end record is only written once all tracks have been, so an incomplete cache is ignored
+*/
+
+char *cache_filename=NULL;
+char *cache_tmpname=NULL;
+
+// Identifies the input and the decoders
+uint64_t cache_inputsize=0;
+uint64_t cache_inputhash=0;
+int cache_decoders=0;
+
+// Cache loaded from an earlier run, with the offset to each track record found in it
+unsigned char *cache_data=NULL;
+unsigned long cache_len=0;
+unsigned long cache_tracks[DISKSTORE_MAXTRACKS][HW_MAXHEADS];
+
+// Updated cache being written, only once a track has needed decoding
+FILE *cache_out=NULL;
+unsigned char cache_stored[DISKSTORE_MAXTRACKS][HW_MAXHEADS];
+
+// Hash the contents of the input file, returns 1 on success
+int cache_hashfile(const char *filename)
+{
+  FILE *fh;
+  unsigned char *buffer;
+  size_t len, i;
+
+  fh=fopen(filename, "rb");
+  if (fh==NULL) return 0;
+
+  buffer=malloc(CACHE_HASHBLOCK);
+  if (buffer==NULL)
+  {
+    fclose(fh);
+    return 0;
+  }
+
+  cache_inputsize=0;
+  cache_inputhash=CACHE_FNVBASIS;
+
+  while ((len=fread(buffer, 1, CACHE_HASHBLOCK, fh))>0)
+  {
+    for (i=0; i<len; i++)
+    {
+      cache_inputhash^=buffer[i];
+      cache_inputhash*=CACHE_FNVPRIME;
+    }
+
+    cache_inputsize+=len;
+  }
+
+  free(buffer);
+  fclose(fh);
+
+  return 1;
+}
+
+// Read the cache from an earlier run, returns 1 if it matches this input and decoders
+int cache_read()
+{
+  FILE *fh;
+  long len;
+  unsigned long pos;
+  unsigned int track, head, count, n;
+
+  fh=fopen(cache_filename, "rb");
+  if (fh==NULL) return 0;
+
+  fseek(fh, 0, SEEK_END);
+  len=ftell(fh);
+  fseek(fh, 0, SEEK_SET);
+
+  if (len<(CACHE_HEADERLEN+1))
+  {
+    fclose(fh);
+    return 0;
+  }
+
+  cache_data=malloc(len);
+  if (cache_data==NULL)
+  {
+    fclose(fh);
+    return 0;
+  }
+
+  cache_len=fread(cache_data, 1, len, fh);
+  fclose(fh);
+
+  // Check it was written for this input file by these decoders
+  if ((cache_len!=(unsigned long)len) ||
+      (memcmp(cache_data, CACHE_MAGIC, CACHE_MAGICLEN)!=0) ||
+      (byteorder_get16(&cache_data[CACHE_MAGICLEN])!=CACHE_VERSION) ||
+      (cache_data[CACHE_MAGICLEN+2]!=cache_decoders) ||
+      (byteorder_get64(&cache_data[CACHE_MAGICLEN+3])!=cache_inputsize) ||
+      (byteorder_get64(&cache_data[CACHE_MAGICLEN+11])!=cache_inputhash))
+    return 0;
+
+  // Find each track record, checking they are all complete
+  pos=CACHE_HEADERLEN;
+
+  while ((pos<cache_len) && (cache_data[pos]==CACHE_TRACK))
+  {
+    if ((pos+CACHE_TRACKLEN)>cache_len)
+      return 0;
+
+    track=cache_data[pos+1];
+    head=cache_data[pos+2];
+    count=byteorder_get16(&cache_data[pos+4]);
+
+    if (head>=HW_MAXHEADS)
+      return 0;
+
+    cache_tracks[track][head]=pos;
+    pos+=CACHE_TRACKLEN;
+
+    for (n=0; n<count; n++)
+    {
+      if ((pos+CACHE_SECTORLEN)>cache_len)
+        return 0;
+
+      pos+=CACHE_SECTORLEN+byteorder_get32(&cache_data[pos+25]);
+
+      if (pos>cache_len)
+        return 0;
+    }
+  }
+
+  return ((pos<cache_len) && (cache_data[pos]==CACHE_END));
+}
+
+// Forget any cache read from an earlier run
+void cache_discard()
+{
+  if (cache_data!=NULL)
+    free(cache_data);
+
+  cache_data=NULL;
+  cache_len=0;
+
+  memset(cache_tracks, 0, sizeof(cache_tracks));
+}
+
+// Open the cache for an input file, returns 1 if decoded tracks were loaded from an earlier run
+int cache_open(const char *samplefile, const int decoders)
+{
+  cache_discard();
+  memset(cache_stored, 0, sizeof(cache_stored));
+
+  cache_decoders=decoders;
+
+  if (!cache_hashfile(samplefile))
+  {
+    printf("Unable to read input file for cache\n");
+    return 0;
+  }
+
+  cache_filename=malloc(strlen(samplefile)+strlen(CACHE_EXTENSION)+1);
+  cache_tmpname=malloc(strlen(samplefile)+strlen(CACHE_EXTENSION)+strlen(CACHE_TMPEXTENSION)+1);
+
+  if ((cache_filename==NULL) || (cache_tmpname==NULL))
+  {
+    cache_close();
+    return 0;
+  }
+
+  sprintf(cache_filename, "%s%s", samplefile, CACHE_EXTENSION);
+  sprintf(cache_tmpname, "%s%s", cache_filename, CACHE_TMPEXTENSION);
+
+  if (cache_read())
+  {
+    printf("Using decoded sectors from %s\n", cache_filename);
+    return 1;
+  }
+
+  cache_discard();
+
+  return 0;
+}
+
+// Add the sectors for a track to the diskstore from the cache, returns 1 if the track was cached
+int cache_loadtrack(const unsigned char track, const unsigned char head)
+{
+  unsigned long pos;
+  unsigned int count, n;
+  unsigned char *sector;
+
+  if ((cache_data==NULL) || (head>=HW_MAXHEADS) || (cache_tracks[track][head]==0))
+    return 0;
+
+  pos=cache_tracks[track][head];
+
+  mod_density|=cache_data[pos+3];
+  count=byteorder_get16(&cache_data[pos+4]);
+  pos+=CACHE_TRACKLEN;
+
+  for (n=0; n<count; n++)
+  {
+    sector=&cache_data[pos];
+
+    diskstore_addsector(sector[0], track, head, sector[1], sector[2], sector[3], sector[4],
+      byteorder_get32(&sector[5]), byteorder_get32(&sector[9]), byteorder_get32(&sector[13]), byteorder_get32(&sector[17]),
+      byteorder_get32(&sector[21]), byteorder_get32(&sector[25]), &sector[CACHE_SECTORLEN], byteorder_get32(&sector[29]));
+
+    pos+=CACHE_SECTORLEN+byteorder_get32(&sector[25]);
+  }
+
+  return 1;
+}
+
+// Save the sectors found for a track which has just been decoded
+void cache_storetrack(const unsigned char track, const unsigned char head)
+{
+  Disk_Sector *curr;
+  unsigned int count, n;
+
+  if ((cache_filename==NULL) || (head>=HW_MAXHEADS))
+    return;
+
+  // Tracks from the earlier run are copied over when the cache is closed
+  if ((cache_tracks[track][head]!=0) || (cache_stored[track][head]))
+    return;
+
+  if (cache_out==NULL)
+  {
+    cache_out=fopen(cache_tmpname, "wb");
+
+    if (cache_out==NULL)
+    {
+      printf("Unable to write cache file\n");
+
+      free(cache_filename);
+      cache_filename=NULL;
+      return;
+    }
+
+    fwrite(CACHE_MAGIC, 1, CACHE_MAGICLEN, cache_out);
+    byteorder_put16(cache_out, CACHE_VERSION);
+    fputc(cache_decoders, cache_out);
+    byteorder_put64(cache_out, cache_inputsize);
+    byteorder_put64(cache_out, cache_inputhash);
+  }
+
+  // Only sectors which still have their data can be saved
+  count=0;
+  for (n=0; (curr=diskstore_findnthsector(track, head, n))!=NULL; n++)
+    if (curr->data!=NULL) count++;
+
+  fputc(CACHE_TRACK, cache_out);
+  fputc(track, cache_out);
+  fputc(head, cache_out);
+  fputc(mod_density, cache_out);
+  byteorder_put16(cache_out, count);
+
+  for (n=0; (curr=diskstore_findnthsector(track, head, n))!=NULL; n++)
+  {
+    if (curr->data==NULL)
+      continue;
+
+    fputc(curr->modulation, cache_out);
+    fputc(curr->logical_track, cache_out);
+    fputc(curr->logical_head, cache_out);
+    fputc(curr->logical_sector, cache_out);
+    fputc(curr->logical_size, cache_out);
+    byteorder_put32(cache_out, curr->id_pos);
+    byteorder_put32(cache_out, curr->idcrc);
+    byteorder_put32(cache_out, curr->data_pos);
+    byteorder_put32(cache_out, curr->data_endpos);
+    byteorder_put32(cache_out, curr->datatype);
+    byteorder_put32(cache_out, curr->datasize);
+    byteorder_put32(cache_out, curr->datacrc);
+    fwrite(curr->data, 1, curr->datasize, cache_out);
+  }
+
+  cache_stored[track][head]=1;
+}
+
+// Write out the updated cache, if any tracks were decoded, then free it
+void cache_close()
+{
+  unsigned int track, head, count, n;
+  unsigned long pos, end;
+  int ok;
+
+  if (cache_out!=NULL)
+  {
+    // Keep the tracks from the earlier run
+    for (track=0; track<DISKSTORE_MAXTRACKS; track++)
+    {
+      for (head=0; head<HW_MAXHEADS; head++)
+      {
+        pos=cache_tracks[track][head];
+
+        if (pos==0) continue;
+
+        count=byteorder_get16(&cache_data[pos+4]);
+        end=pos+CACHE_TRACKLEN;
+
+        for (n=0; n<count; n++)
+          end+=CACHE_SECTORLEN+byteorder_get32(&cache_data[end+25]);
+
+        fwrite(&cache_data[pos], 1, end-pos, cache_out);
+      }
+    }
+
+    fputc(CACHE_END, cache_out);
+
+    ok=(ferror(cache_out)==0);
+
+    if (fclose(cache_out)!=0)
+      ok=0;
+
+    cache_out=NULL;
+
+    // Replace the old cache in one go, so it is never left half written
+    if ((!ok) || (rename(cache_tmpname, cache_filename)!=0))
+    {
+      printf("Unable to write cache file\n");
+      remove(cache_tmpname);
+    }
+  }
+
+  cache_discard();
+
+  if (cache_filename!=NULL)
+    free(cache_filename);
+
+  if (cache_tmpname!=NULL)
+    free(cache_tmpname);
+
+  cache_filename=NULL;
+  cache_tmpname=NULL;
+}
@@ -0,0 +1,44 @@
+#ifndef _CACHE_H_
+#define _CACHE_H_
+
+#include <stdint.h>
+
+// Change whenever the decoders could find different sectors in the same samples
+#define CACHE_VERSION 1
+
+#define CACHE_MAGIC "FDCCACHE"
+#define CACHE_MAGICLEN 8
+
+// Added to the input filename to name the sidecar cache
+#define CACHE_EXTENSION ".cache"
+#define CACHE_TMPEXTENSION ".tmp"
+
+// Record types
+#define CACHE_TRACK 'T'
+#define CACHE_END 'E'
+
+// Sizes of the fixed parts of the file
+#define CACHE_HEADERLEN (CACHE_MAGICLEN+2+1+8+8)
+#define CACHE_TRACKLEN (1+1+1+1+2)
+#define CACHE_SECTORLEN (5+(7*4))
+
+// Bytes of the input file hashed at a time
+#define CACHE_HASHBLOCK (64*1024)
+
+// FNV-1a 64 bit hash of the input file
+#define CACHE_FNVBASIS 0xcbf29ce484222325ULL
+#define CACHE_FNVPRIME 0x100000001b3ULL
+
+// Open the cache for an input file, returns 1 if decoded tracks were loaded from an earlier run
+extern int cache_open(const char *samplefile, const int decoders);
+
+// Add the sectors for a track to the diskstore from the cache, returns 1 if the track was cached
+extern int cache_loadtrack(const unsigned char track, const unsigned char head);
+
+// Save the sectors found for a track which has just been decoded
+extern void cache_storetrack(const unsigned char track, const unsigned char head);
+
+// Write out the updated cache, if any tracks were decoded, then free it
+extern void cache_close();
+
+#endif
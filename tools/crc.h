@@ -3,5 +3,6 @@
 
 extern unsigned int calc_crc_stream(const unsigned char *data, const int datalen, const unsigned int initial, const unsigned int polynomial);
 extern unsigned int calc_crc(const unsigned char *data, const int datalen);
+extern unsigned long calc_crc32(const unsigned char *data, const unsigned long datalen, const unsigned long previous);
 
 #endif
@@ -1,6 +1,8 @@
 #include <stdlib.h>
 #include <strings.h>
 
+#include "hardware.h"
+#include "mod.h"
 #include "dfi.h"
 
 /*
@@ -78,52 +80,57 @@ void dfi_writeheader(FILE *dfifile)
   fprintf(dfifile, "%s", DFI_MAGIC);
 }
 
-// DFE2 encode raw binary sample data
-unsigned long dfi_encodedata(unsigned char *buffer, const unsigned long maxdfilen, const unsigned char *rawtrackdata, const unsigned long rawdatalength, const unsigned int rotations)
+// DFE2 encode flux runs
+unsigned long dfi_encodedata(unsigned char *buffer, const unsigned long maxdfilen, const Mod_Flux *flux, const unsigned int rotations)
 {
   unsigned long dfilen=0;
-  unsigned char c;
-  char state=0;
-  unsigned int i, j;
-  unsigned char carry=0;
+  unsigned long i;
+  unsigned long carry=0;
+  unsigned long pos=0;
+  char state;
 
   // Determine starting sample level
-  state=(rawtrackdata[0]&0x80)>>7;
+  state=flux->level;
 
-  for (i=0; i<rawdatalength; i++)
+  for (i=0; i<=flux->len; i++)
   {
-    c=rawtrackdata[i];
-
-    // Process each of the 8 sample bits looking for state change
-    for (j=0; j<8; j++)
+    if (i<flux->len)
     {
-      carry++;
-
-      if (carry==DFI_CARRY)
+      // Look for extended runs
+      if (flux->runs[i]==0)
       {
-        // Check for buffer overflow
-        if ((dfilen+1)>=maxdfilen) return 0;
-
-        buffer[dfilen++]=DFI_CARRY;
-        carry=0;
+        carry+=MOD_FLUXEXTEND;
+        pos+=MOD_FLUXEXTEND;
+        continue;
       }
 
-      if (((c&0x80)>>7)!=state)
-      {
-        state=1-state;
+      carry+=flux->runs[i];
+      pos+=flux->runs[i];
+      state=1-state;
+    }
+    else
+      carry+=(flux->samples-pos); // Samples following the last level change
 
-        // Having seen an "original" .dfi file, it looks like it only stores READ pin rising edge deltas
-        if (state==1)
-        {
-          // Check for buffer overflow
-          if ((dfilen+1)>=maxdfilen) return 0;
+    // Having seen an "original" .dfi file, it looks like it only stores READ pin rising edge deltas
+    if ((i<flux->len) && (state==0))
+      continue;
 
-          buffer[dfilen++]=carry;
-          carry=0;
-        }
-      }
+    while (carry>=DFI_CARRY)
+    {
+      // Check for buffer overflow
+      if ((dfilen+1)>=maxdfilen) return 0;
+
+      buffer[dfilen++]=DFI_CARRY;
+      carry-=DFI_CARRY;
+    }
+
+    if (i<flux->len)
+    {
+      // Check for buffer overflow
+      if ((dfilen+1)>=maxdfilen) return 0;
 
-      c=c<<1;
+      buffer[dfilen++]=carry;
+      carry=0;
     }
   }
 
@@ -134,11 +141,12 @@ unsigned long dfi_encodedata(unsigned char *buffer, const unsigned long maxdfile
   return dfilen;
 }
 
-void dfi_writetrack(FILE *dfifile, const int track, const int side, const unsigned char *rawtrackdata, const unsigned long rawdatalength, const unsigned int rotations)
+void dfi_writetrack(FILE *dfifile, const int track, const int side, const Mod_Flux *flux, const unsigned int rotations)
 {
   unsigned char trackheader[10];
   unsigned char *dfidata;
   unsigned long dfidatalength;
+  unsigned long rawdatalength;
 
   if (dfifile==NULL) return;
 
@@ -156,11 +164,12 @@ void dfi_writetrack(FILE *dfifile, const int track, const int side, const unsign
   // Sector/Record
   // Assume 0 - soft sectored
 
-  // Convert data to DFI 2 format
+  // Convert data to DFI 2 format, allowing as much space as the raw samples took
+  rawdatalength=flux->samples/BITSPERBYTE;
   dfidata=malloc(rawdatalength);
   if (dfidata==NULL) return;
 
-  dfidatalength=dfi_encodedata(dfidata, rawdatalength, rawtrackdata, rawdatalength, rotations);
+  dfidatalength=dfi_encodedata(dfidata, rawdatalength, flux, rotations);
   if (dfidatalength==0)
   {
     free(dfidata);
@@ -3,12 +3,14 @@
 
 #include <stdio.h>
 
+#include "mod.h"
+
 #define DFI_MAGIC "DFE2"
 
 #define DFI_CARRY 0x7f
 
 extern void dfi_writeheader(FILE *dfifile);
 
-extern void dfi_writetrack(FILE *dfifile, const int track, const int side, const unsigned char *rawtrackdata, const unsigned long rawdatalength, const unsigned int rotations);
+extern void dfi_writetrack(FILE *dfifile, const int track, const int side, const Mod_Flux *flux, const unsigned int rotations);
 
 #endif
@@ -8,6 +8,16 @@
 #include "mod.h"
 
 Disk_Sector *Disk_SectorsRoot;
+Disk_Sector *diskstore_lastsector=NULL;
+
+// Index of sectors by physical track/head
+Disk_Track diskstore_tracks[DISKSTORE_MAXTRACKS][HW_MAXHEADS];
+
+// Slabs of memory holding sector records and data, the first one is being carved from
+Disk_Slab *diskstore_slabs=NULL;
+
+// Released sector data, by power of 2 size
+Disk_Free *diskstore_free[DISKSTORE_MAXFREESHIFT+1];
 
 // For stats
 int diskstore_mintrack=-1;
@@ -25,19 +35,166 @@ int diskstore_abshead=-1;
 int diskstore_abssector=-1;
 int diskstore_abssecoffs=-1;
 unsigned long diskstore_absoffset=0;
+Disk_Sector *diskstore_abscurr=NULL; // Last sector read from, so reads within it don't need to search
+
+// Tracks which have been fetched to find missing sectors, so each is only fetched once
+unsigned char diskstore_fetched[DISKSTORE_MAXTRACKS][HW_MAXHEADS];
+int diskstore_lastfetchtrack=-1;
+int diskstore_lastfetchhead=-1;
+
+// Carve memory for a sector record or data from the slabs, it is only freed when the store is cleared
+void *diskstore_alloc(const unsigned long len)
+{
+  Disk_Slab *slab;
+  unsigned long alignedlen;
+  void *mem;
+
+  alignedlen=((len+(DISKSTORE_SLABALIGN-1))/DISKSTORE_SLABALIGN)*DISKSTORE_SLABALIGN;
+
+  slab=diskstore_slabs;
+
+  if ((slab==NULL) || ((slab->used+alignedlen)>slab->size))
+  {
+    // Start a new slab, with anything too big for a whole slab getting one to itself
+    slab=malloc(sizeof(Disk_Slab));
+    if (slab==NULL) return NULL;
+
+    slab->size=(alignedlen>DISKSTORE_SLABSIZE)?alignedlen:DISKSTORE_SLABSIZE;
+    slab->used=0;
+    slab->data=malloc(slab->size);
+
+    if (slab->data==NULL)
+    {
+      free(slab);
+      return NULL;
+    }
+
+    // Keep carving from the current slab when this one is already full
+    if ((diskstore_slabs!=NULL) && (alignedlen>=DISKSTORE_SLABSIZE))
+    {
+      slab->next=diskstore_slabs->next;
+      diskstore_slabs->next=slab;
+    }
+    else
+    {
+      slab->next=diskstore_slabs;
+      diskstore_slabs=slab;
+    }
+  }
+
+  mem=&slab->data[slab->used];
+  slab->used+=alignedlen;
+
+  return mem;
+}
+
+// Find which list of released memory a length belongs to, or -1 when not recycled
+int diskstore_freelist(const unsigned long len)
+{
+  int shift;
+
+  for (shift=DISKSTORE_MINFREESHIFT; shift<=DISKSTORE_MAXFREESHIFT; shift++)
+  {
+    if (len==(1UL<<shift))
+      return shift;
+  }
+
+  return -1;
+}
+
+// Carve memory for sector data from the slabs, reusing released memory of the same size if possible
+void *diskstore_allocdata(const unsigned long len)
+{
+  Disk_Free *mem;
+  int shift;
+
+  shift=diskstore_freelist(len);
+
+  if ((shift!=-1) && (diskstore_free[shift]!=NULL))
+  {
+    mem=diskstore_free[shift];
+    diskstore_free[shift]=mem->next;
+
+    return mem;
+  }
+
+  return diskstore_alloc(len);
+}
+
+// Release sector data so it can be reused, memory of sizes which aren't recycled stays in the slabs
+void diskstore_freedata(void *data, const unsigned long len)
+{
+  Disk_Free *mem;
+  int shift;
+
+  shift=diskstore_freelist(len);
+
+  if ((data==NULL) || (shift==-1))
+    return;
+
+  mem=(Disk_Free *)data;
+  mem->next=diskstore_free[shift];
+  diskstore_free[shift]=mem;
+}
+
+// Find the index entry for a physical track/head
+Disk_Track *diskstore_findtrack(const unsigned char physical_track, const unsigned char physical_head)
+{
+  if (physical_head>=HW_MAXHEADS)
+    return NULL;
+
+  return &diskstore_tracks[physical_track][physical_head];
+}
+
+// Add a sector to the end of the index for its physical track/head
+void diskstore_indexsector(Disk_Sector *sector)
+{
+  Disk_Track *track;
+
+  track=diskstore_findtrack(sector->physical_track, sector->physical_head);
+  if (track==NULL) return;
+
+  sector->tracknext=NULL;
+
+  if (track->last==NULL)
+    track->first=sector;
+  else
+    track->last->tracknext=sector;
+
+  track->last=sector;
+  track->count++;
+
+  track->sectormap[sector->logical_sector/8]|=(1<<(sector->logical_sector%8));
+}
+
+// Rebuild the index from the linked list, after the list has been reordered
+void diskstore_reindex()
+{
+  Disk_Sector *curr;
+
+  memset(diskstore_tracks, 0, sizeof(diskstore_tracks));
+  diskstore_lastsector=NULL;
+  diskstore_abscurr=NULL;
+
+  for (curr=Disk_SectorsRoot; curr!=NULL; curr=curr->next)
+  {
+    diskstore_indexsector(curr);
+    diskstore_lastsector=curr;
+  }
+}
 
 // Find sector in store to make sure there is no exact match when adding
 Disk_Sector *diskstore_findexactsector(const unsigned char physical_track, const unsigned char physical_head, const unsigned char logical_track, const unsigned char logical_head, const unsigned char logical_sector, const unsigned char logical_size, const unsigned int idcrc, const unsigned int datatype, const unsigned int datasize, const unsigned int datacrc)
 {
+  Disk_Track *track;
   Disk_Sector *curr;
 
-  curr=Disk_SectorsRoot;
+  track=diskstore_findtrack(physical_track, physical_head);
+  if (track==NULL) return NULL;
 
-  while (curr!=NULL)
+  for (curr=track->first; curr!=NULL; curr=curr->tracknext)
   {
-    if ((curr->physical_track==physical_track) &&
-        (curr->physical_head==physical_head) &&
-        (curr->logical_track==logical_track) &&
+    if ((curr->logical_track==logical_track) &&
         (curr->logical_head==logical_head) &&
         (curr->logical_sector==logical_sector) &&
         (curr->logical_size==logical_size) &&
@@ -46,8 +203,6 @@ Disk_Sector *diskstore_findexactsector(const unsigned char physical_track, const
         (curr->datasize==datasize) &&
         (curr->datacrc==datacrc))
       return curr;
-
-    curr=curr->next;
   }
 
   return NULL;
@@ -76,62 +231,168 @@ Disk_Sector *diskstore_findlogicalsector(const unsigned char logical_track, cons
 // Find sector by hybrid physical/logical position
 Disk_Sector *diskstore_findhybridsector(const unsigned char physical_track, const unsigned char physical_head, const unsigned char logical_sector)
 {
+  Disk_Track *track;
   Disk_Sector *curr;
 
-  curr=Disk_SectorsRoot;
+  track=diskstore_findtrack(physical_track, physical_head);
+  if (track==NULL) return NULL;
 
-  while (curr!=NULL)
+  for (curr=track->first; curr!=NULL; curr=curr->tracknext)
   {
-    if ((curr->physical_track==physical_track) &&
-        (curr->physical_head==physical_head) &&
-        (curr->logical_sector==logical_sector))
+    if (curr->logical_sector==logical_sector)
       return curr;
+  }
 
-    curr=curr->next;
+  return NULL;
+}
+
+// Find a sector for given physical track/head with a matching ID block, so a sector seen again need not be decoded
+Disk_Sector *diskstore_findidsector(const unsigned char physical_track, const unsigned char physical_head, const unsigned char logical_track, const unsigned char logical_head, const unsigned char logical_sector, const unsigned char logical_size, const unsigned int idcrc)
+{
+  Disk_Track *track;
+  Disk_Sector *curr;
+
+  track=diskstore_findtrack(physical_track, physical_head);
+  if (track==NULL) return NULL;
+
+  // No need to search if this sector ID isn't held
+  if ((track->sectormap[logical_sector/8]&(1<<(logical_sector%8)))==0)
+    return NULL;
+
+  for (curr=track->first; curr!=NULL; curr=curr->tracknext)
+  {
+    if ((curr->logical_track==logical_track) &&
+        (curr->logical_head==logical_head) &&
+        (curr->logical_sector==logical_sector) &&
+        (curr->logical_size==logical_size) &&
+        (curr->idcrc==idcrc))
+      return curr;
   }
 
   return NULL;
 }
 
+// Check if a logical sector ID is held for given physical track/head
+int diskstore_hassector(const unsigned char physical_track, const unsigned char physical_head, const unsigned char logical_sector)
+{
+  Disk_Track *track;
+
+  track=diskstore_findtrack(physical_track, physical_head);
+  if (track==NULL) return 0;
+
+  return ((track->sectormap[logical_sector/8]&(1<<(logical_sector%8)))!=0);
+}
+
+// Check if all of the logical sector IDs from 0 up to the number of sectors given are held for physical track/head
+int diskstore_hassectors(const unsigned char physical_track, const unsigned char physical_head, const int sectors)
+{
+  Disk_Track *track;
+  int i;
+
+  track=diskstore_findtrack(physical_track, physical_head);
+  if (track==NULL) return 0;
+
+  // Check whole bytes of the map first
+  for (i=0; ((i+8)<=sectors) && (i<(DISKSTORE_SECTORMAPSIZE*8)); i+=8)
+  {
+    if (track->sectormap[i/8]!=0xff)
+      return 0;
+  }
+
+  // Then any sectors left over
+  if ((i<sectors) && (i<(DISKSTORE_SECTORMAPSIZE*8)))
+  {
+    unsigned char mask;
+
+    mask=(1<<(sectors-i))-1;
+
+    if ((track->sectormap[i/8]&mask)!=mask)
+      return 0;
+  }
+
+  return 1;
+}
+
+// Copy the map of logical sector IDs held for physical track/head
+void diskstore_getsectormap(const unsigned char physical_track, const unsigned char physical_head, unsigned char *sectormap)
+{
+  Disk_Track *track;
+
+  track=diskstore_findtrack(physical_track, physical_head);
+  if (track==NULL)
+    bzero(sectormap, DISKSTORE_SECTORMAPSIZE);
+  else
+    memcpy(sectormap, track->sectormap, DISKSTORE_SECTORMAPSIZE);
+}
+
+// Check if every logical sector ID in the map given is held for physical track/head
+int diskstore_hassectormap(const unsigned char physical_track, const unsigned char physical_head, const unsigned char *sectormap)
+{
+  Disk_Track *track;
+  int i;
+
+  track=diskstore_findtrack(physical_track, physical_head);
+  if (track==NULL) return 0;
+
+  for (i=0; i<DISKSTORE_SECTORMAPSIZE; i++)
+  {
+    if ((track->sectormap[i]&sectormap[i])!=sectormap[i])
+      return 0;
+  }
+
+  return 1;
+}
+
 // Find nth sector for given physical track/head
 Disk_Sector *diskstore_findnthsector(const unsigned char physical_track, const unsigned char physical_head, const unsigned char nth_sector)
 {
+  Disk_Track *track;
   Disk_Sector *curr;
   int n;
 
-  curr=Disk_SectorsRoot;
-  n=0;
+  track=diskstore_findtrack(physical_track, physical_head);
+  if ((track==NULL) || (nth_sector>=track->count)) return NULL;
 
-  while (curr!=NULL)
-  {
-    if ((curr->physical_track==physical_track) && (curr->physical_head==physical_head))
-    {
-      if (n==nth_sector)
-        return curr;
-      n++;
-    }
+  curr=track->first;
 
-    curr=curr->next;
-  }
+  for (n=0; n<nth_sector; n++)
+    curr=curr->tracknext;
 
-  return NULL;
+  return curr;
 }
 
 // Count how many sectors we have for given physical track/head
 unsigned char diskstore_countsectors(const unsigned char physical_track, const unsigned char physical_head)
 {
+  Disk_Track *track;
+
+  track=diskstore_findtrack(physical_track, physical_head);
+  if (track==NULL) return 0;
+
+  return track->count;
+}
+
+// Count how many different logical sectors we have for given physical track/head
+unsigned char diskstore_countlogicalsectors(const unsigned char physical_track, const unsigned char physical_head)
+{
+  Disk_Track *track;
   Disk_Sector *curr;
+  unsigned char seen[256/8];
   int n;
 
-  curr=Disk_SectorsRoot;
+  track=diskstore_findtrack(physical_track, physical_head);
+  if (track==NULL) return 0;
+
+  memset(seen, 0, sizeof(seen));
   n=0;
 
-  while (curr!=NULL)
+  for (curr=track->first; curr!=NULL; curr=curr->tracknext)
   {
-    if ((curr->physical_track==physical_track) && (curr->physical_head==physical_head))
+    if ((seen[curr->logical_sector/8]&(1<<(curr->logical_sector%8)))==0)
+    {
+      seen[curr->logical_sector/8]|=(1<<(curr->logical_sector%8));
       n++;
-
-    curr=curr->next;
+    }
   }
 
   return n;
@@ -188,62 +449,104 @@ int diskstore_comparesectors(Disk_Sector *item1, Disk_Sector *item2)
   return 0;
 }
 
-// Bubble sort the sectors to be in TRACK/HEAD/SECTOR order rather than the order they were added
+// Merge two sorted lists of sectors, keeping sectors which compare the same in their original order
+Disk_Sector *diskstore_mergesectors(Disk_Sector *list1, Disk_Sector *list2)
+{
+  Disk_Sector *head;
+  Disk_Sector **tail;
+
+  head=NULL;
+  tail=&head;
+
+  while ((list1!=NULL) && (list2!=NULL))
+  {
+    if (diskstore_comparesectors(list1, list2)==1)
+    {
+      *tail=list2;
+      list2=list2->next;
+    }
+    else
+    {
+      *tail=list1;
+      list1=list1->next;
+    }
+
+    tail=&(*tail)->next;
+  }
+
+  *tail=(list1!=NULL)?list1:list2;
+
+  return head;
+}
+
+// Merge sort the sectors to be in TRACK/HEAD/SECTOR order rather than the order they were added
 void diskstore_sortsectors()
 {
-  int swaps;
+  Disk_Sector *runs[sizeof(unsigned long)*BITSPERBYTE];
   Disk_Sector *curr;
-  Disk_Sector *prev;
-  Disk_Sector *swap;
+  Disk_Sector *next;
+  unsigned int i, maxrun;
 
   // Check for empty diskstore
   if (Disk_SectorsRoot==NULL)
     return;
 
-  do
+  // Bottom up, where runs[i] holds a sorted run of 2^i sectors
+  maxrun=0;
+  for (i=0; i<(sizeof(runs)/sizeof(runs[0])); i++)
+    runs[i]=NULL;
+
+  for (curr=Disk_SectorsRoot; curr!=NULL; curr=next)
   {
-    swaps=0;
-    curr=Disk_SectorsRoot;
-    prev=NULL;
+    next=curr->next;
+    curr->next=NULL;
 
-    while ((curr!=NULL) && (curr->next!=NULL))
+    // Merge with runs of the same length, earlier sectors being on the left
+    for (i=0; (i<maxrun) && (runs[i]!=NULL); i++)
     {
-      // Check if these two sectors need swapping
-      if (diskstore_comparesectors(curr, curr->next)==1)
-      {
-        // Swap the pointers over in the linked list
-        swap=curr->next;
-        curr->next=swap->next;
-        swap->next=curr;
+      curr=diskstore_mergesectors(runs[i], curr);
+      runs[i]=NULL;
+    }
 
-        if (prev==NULL)
-          Disk_SectorsRoot=swap;
-        else
-          prev->next=swap;
+    if (i==(sizeof(runs)/sizeof(runs[0])))
+      i--;
 
-        swaps++;
-      }
+    runs[i]=curr;
 
-      // Move on to the next pair of sectors
-      prev=curr;
-      curr=curr->next;
-    }
-  } while (swaps>0);
+    if (i>=maxrun)
+      maxrun=i+1;
+  }
+
+  // Merge the remaining runs, from the shortest which holds the latest sectors
+  curr=NULL;
+  for (i=0; i<maxrun; i++)
+  {
+    if (runs[i]!=NULL)
+      curr=(curr==NULL)?runs[i]:diskstore_mergesectors(runs[i], curr);
+  }
+
+  Disk_SectorsRoot=curr;
+
+  // Sectors on each track are now in a different order
+  diskstore_reindex();
 }
 
 // Add a sector to linked list
-int diskstore_addsector(const unsigned char modulation, const unsigned char physical_track, const unsigned char physical_head, const unsigned char logical_track, const unsigned char logical_head, const unsigned char logical_sector, const unsigned char logical_size, const long id_pos, const unsigned int idcrc, const long data_pos, const unsigned int datatype, const unsigned int datasize, const unsigned char *data, const unsigned int datacrc)
+int diskstore_addsector(const unsigned char modulation, const unsigned char physical_track, const unsigned char physical_head, const unsigned char logical_track, const unsigned char logical_head, const unsigned char logical_sector, const unsigned char logical_size, const long id_pos, const unsigned int idcrc, const long data_pos, const long data_endpos, const unsigned int datatype, const unsigned int datasize, const unsigned char *data, const unsigned int datacrc)
 {
-  Disk_Sector *curr;
   Disk_Sector *newitem;
 
+  // Only sectors which can be indexed are stored
+  if (diskstore_findtrack(physical_track, physical_head)==NULL)
+    return 0;
+
   // First check if we already have this sector
   if (diskstore_findexactsector(physical_track, physical_head, logical_track, logical_head, logical_sector, logical_size, idcrc, datatype, datasize, datacrc)!=NULL)
     return 0;
 
 //  fprintf(stderr, "Adding physical T:%d H:%d  |  logical C:%d H:%d R:%d N:%d (%.4x) [%.2x] %d data bytes (%.4x)\n", physical_track, physical_head, logical_track, logical_head, logical_sector, logical_size, idcrc, datatype, datasize, datacrc);
 
-  newitem=malloc(sizeof(Disk_Sector));
+  newitem=diskstore_alloc(sizeof(Disk_Sector));
   if (newitem==NULL) return 0;
 
   newitem->physical_track=physical_track;
@@ -256,14 +559,14 @@ int diskstore_addsector(const unsigned char modulation, const unsigned char phys
   newitem->idcrc=idcrc;
   newitem->id_pos=id_pos;
   newitem->data_pos=data_pos;
-  newitem->data_endpos=mod_datapos;
+  newitem->data_endpos=data_endpos;
 
   newitem->modulation=modulation;
 
   newitem->datatype=datatype;
   newitem->datasize=datasize;
 
-  newitem->data=malloc(datasize);
+  newitem->data=diskstore_allocdata(datasize);
   if (newitem->data!=NULL)
     memcpy(newitem->data, data, datasize);
 
@@ -295,20 +598,15 @@ int diskstore_addsector(const unsigned char modulation, const unsigned char phys
   if ((diskstore_minsectorid==-1) || (logical_sector<diskstore_minsectorid))
     diskstore_minsectorid=logical_sector;
 
-  // Add the new sector to the dynamic linked list
+  // Add the new sector to the end of the dynamic linked list
   if (Disk_SectorsRoot==NULL)
-  {
     Disk_SectorsRoot=newitem;
-  }
   else
-  {
-    curr=Disk_SectorsRoot;
+    diskstore_lastsector->next=newitem;
 
-    while (curr->next!=NULL)
-      curr=curr->next;
+  diskstore_lastsector=newitem;
 
-    curr->next=newitem;
-  }
+  diskstore_indexsector(newitem);
 
   return 1;
 }
@@ -316,24 +614,38 @@ int diskstore_addsector(const unsigned char modulation, const unsigned char phys
 // Delete all saved sectors
 void diskstore_clearallsectors()
 {
-  Disk_Sector *curr;
-  void *prev;
-
-  curr=Disk_SectorsRoot;
+  Disk_Slab *slab;
 
-  while (curr!=NULL)
+  // Sector records and data are all within the slabs
+  while (diskstore_slabs!=NULL)
   {
-    if (curr->data!=NULL)
-      free(curr->data);
-
-    prev=curr;
-    curr=curr->next;
+    slab=diskstore_slabs;
+    diskstore_slabs=slab->next;
 
-    if (prev!=NULL)
-      free(prev);
+    free(slab->data);
+    free(slab);
   }
 
+  memset(diskstore_free, 0, sizeof(diskstore_free));
+
   Disk_SectorsRoot=NULL;
+  diskstore_reindex();
+}
+
+// Release the data for all sectors on a physical track/head once it is no longer needed, the sectors are still listed
+void diskstore_releasetrack(const unsigned char physical_track, const unsigned char physical_head)
+{
+  Disk_Track *track;
+  Disk_Sector *curr;
+
+  track=diskstore_findtrack(physical_track, physical_head);
+  if (track==NULL) return;
+
+  for (curr=track->first; curr!=NULL; curr=curr->tracknext)
+  {
+    diskstore_freedata(curr->data, curr->datasize);
+    curr->data=NULL;
+  }
 }
 
 // Dump a list of all sectors found
@@ -449,7 +761,8 @@ void diskstore_dumplayoutmap(const int rotations)
 // Absolute seek
 void diskstore_absoluteseek(const unsigned long offset, const int interlacing, const int maxtracks)
 {
-  unsigned long diskoffs;
+  unsigned long diskoffs, sector;
+  unsigned long sectors, tracks, heads;
 
   // Validate track range
   if ((diskstore_maxtrack==-1) || (diskstore_mintrack==-1))
@@ -467,68 +780,108 @@ void diskstore_absoluteseek(const unsigned long offset, const int interlacing, c
   diskstore_abstrack=diskstore_mintrack;
   diskstore_abshead=diskstore_minhead;
   diskstore_abssector=diskstore_minsectorid;
-  diskstore_abssecoffs=0;
-
-  diskoffs=offset;
 
   // Convert absolute offset to C/H/S/sector offset
-  while (diskoffs>=(unsigned int)diskstore_minsectorsize)
+  sector=offset/diskstore_minsectorsize;
+  diskoffs=offset%diskstore_minsectorsize;
+
+  // When the first track is beyond the last, every sector wraps around back to the start
+  if (diskstore_mintrack<=maxtracks)
   {
-    diskstore_abssecoffs+=diskstore_minsectorsize;
-    diskoffs-=diskstore_minsectorsize;
+    sectors=(diskstore_maxsectorid-diskstore_minsectorid)+1;
+    tracks=(maxtracks-diskstore_mintrack)+1;
+    heads=(diskstore_maxhead-diskstore_minhead)+1;
 
-    // Check for pointer going to next sector
-    if (diskstore_abssecoffs>=diskstore_minsectorsize)
+    switch (interlacing)
     {
-      diskstore_abssecoffs-=diskstore_minsectorsize;
-      diskstore_abssector++;
+      case SEQUENCED: // All of head 0, then all of head 1 (if head 1 exists)
+        sector%=(sectors*tracks*heads); // Wrap around back to start when seeking past end of disk
+        diskstore_abssector=diskstore_minsectorid+(sector%sectors);
+        diskstore_abstrack=diskstore_mintrack+((sector/sectors)%tracks);
+        diskstore_abshead=diskstore_minhead+((sector/sectors)/tracks);
+        break;
+
+      case INTERLEAVED: // For each track, head 0 then head 1 (most common for double sided)
+        sector%=(sectors*tracks*heads);
+        diskstore_abssector=diskstore_minsectorid+(sector%sectors);
+        diskstore_abshead=diskstore_minhead+((sector/sectors)%heads);
+        diskstore_abstrack=diskstore_mintrack+((sector/sectors)/heads);
+        break;
+
+      default: // Stay on the first track
+        diskstore_abssector=diskstore_minsectorid+(sector%sectors);
+        break;
+    }
+  }
+
+  // Store new offsets
+  diskstore_abssecoffs=diskoffs;
+  diskstore_absoffset=offset;
+}
 
-      // Check for pointer going to next track or head
-      if (diskstore_abssector>diskstore_maxsectorid)
+// Find the track/head which follows the given one in absolute reads, returns 0 at the end of the disk
+int diskstore_nexttrack(const int interlacing, const int maxtracks, int *track, int *head)
+{
+  switch (interlacing)
+  {
+    case SEQUENCED: // All of head 0, then all of head 1 (if head 1 exists)
+      (*track)++;
+
+      if ((*track)>maxtracks)
       {
-        diskstore_abssector=diskstore_minsectorid;
+        (*track)=diskstore_mintrack;
+        (*head)++;
+      }
+      break;
 
-        switch (interlacing)
-        {
-          case SEQUENCED: // All of head 0, then all of head 1 (if head 1 exists)
-            diskstore_abstrack++;
-
-            if (diskstore_abstrack>maxtracks)
-            {
-              diskstore_abstrack=diskstore_mintrack;
-              diskstore_abshead++;
-            }
-            break;
-
-          case INTERLEAVED: // For each track, head 0 then head 1 (most common for double sided)
-            diskstore_abshead++;
-
-            if (diskstore_abshead>diskstore_maxhead)
-            {
-              diskstore_abshead=diskstore_minhead;
-              diskstore_abstrack++;
-            }
-            break;
-
-          default:
-            break;
-        }
+    case INTERLEAVED: // For each track, head 0 then head 1 (most common for double sided)
+      (*head)++;
+
+      if ((*head)>diskstore_maxhead)
+      {
+        (*head)=diskstore_minhead;
+        (*track)++;
       }
-    }
+      break;
 
-    // Check for seeking past end of disk, to wrap around back to start
-    if ((diskstore_abshead>diskstore_maxhead) || (diskstore_abstrack>maxtracks))
-    {
-//printf("DS wrap around\n");
-      diskstore_abstrack=diskstore_mintrack;
-      diskstore_abshead=diskstore_minhead;
-      diskstore_abssector=diskstore_minsectorid;
-    }
+    default:
+      return 0;
   }
 
-  // Store new offsets
-  diskstore_abssecoffs=diskoffs;
-  diskstore_absoffset=offset;
+  return (((*head)<=diskstore_maxhead) && ((*track)<=maxtracks));
+}
+
+// Capture and decode a track to look for sectors missing from the store, each track is only fetched once
+void diskstore_fetchtrack(const int track, const int head)
+{
+  unsigned char *samplebuffer;
+  unsigned long samplebuffsize;
+
+  if ((track<0) || (track>=DISKSTORE_MAXTRACKS) || (head<0) || (head>=HW_MAXHEADS))
+    return;
+
+  if (diskstore_fetched[track][head]!=DISKSTORE_NOTFETCHED)
+    return;
+
+  samplebuffsize=((hw_samplerate/HW_ROTATIONSPERSEC)/BITSPERBYTE)*3;
+  samplebuffer=(unsigned char *)hw_acquirebuffer(samplebuffsize);
+
+  if (samplebuffer==NULL)
+    return;
+
+  hw_seektotrack(track);
+  hw_sideselect(head);
+  hw_sleep(1);
+  hw_samplerawtrackdata((char *)samplebuffer, samplebuffsize);
+  mod_process(samplebuffer, samplebuffsize, 99);
+
+  hw_releasebuffer((char *)samplebuffer);
+
+  // Remember unreadable tracks too, so they aren't tried again
+  diskstore_fetched[track][head]=(diskstore_countsectors(track, head)>0)?DISKSTORE_FETCHED:DISKSTORE_UNREADABLE;
+
+  diskstore_lastfetchtrack=track;
+  diskstore_lastfetchhead=head;
 }
 
 // Absolute read
@@ -549,36 +902,42 @@ unsigned long diskstore_absoluteread(char *buffer, const unsigned long bufflen,
     if ((numread+toread)>bufflen)
       toread=bufflen-numread;
 
-    // Find this sector
-    curr=diskstore_findhybridsector(diskstore_abstrack, diskstore_abshead, diskstore_abssector);
+    // Find this sector, unless it was the last one read from
+    curr=diskstore_abscurr;
+
+    if ((curr==NULL) || (curr->physical_track!=diskstore_abstrack) || (curr->physical_head!=diskstore_abshead) || (curr->logical_sector!=diskstore_abssector))
+      curr=diskstore_findhybridsector(diskstore_abstrack, diskstore_abshead, diskstore_abssector);
 
     // If sector not found in the store, maybe it hasn't been read yet
-    if ((curr==NULL) || (curr->data==NULL))
+    if (((curr==NULL) || (curr->data==NULL)) && (diskstore_abstrack>=0) && (diskstore_abstrack<DISKSTORE_MAXTRACKS) && (diskstore_abshead>=0) && (diskstore_abshead<HW_MAXHEADS) && (diskstore_fetched[diskstore_abstrack][diskstore_abshead]==DISKSTORE_NOTFETCHED))
     {
-      unsigned char *samplebuffer;
-      unsigned long samplebuffsize;
+      int track, head, sequential;
 
-      samplebuffsize=((hw_samplerate/HW_ROTATIONSPERSEC)/BITSPERBYTE)*3;
-      samplebuffer=malloc(samplebuffsize);
+      // Check if this carries on from the last track fetched
+      track=diskstore_lastfetchtrack;
+      head=diskstore_lastfetchhead;
+      sequential=((track!=-1) && (diskstore_nexttrack(interlacing, maxtracks, &track, &head)) && (track==diskstore_abstrack) && (head==diskstore_abshead));
 
-      if (samplebuffer!=NULL)
-      {
-        hw_seektotrack(diskstore_abstrack);
-        hw_sideselect(diskstore_abshead);
-        hw_sleep(1);
-        hw_samplerawtrackdata((char *)samplebuffer, samplebuffsize);
-        mod_process(samplebuffer, samplebuffsize, 99);
-
-        free(samplebuffer);
-        samplebuffer=NULL;
-      }
+      diskstore_fetchtrack(diskstore_abstrack, diskstore_abshead);
 
       // Look again
       curr=diskstore_findhybridsector(diskstore_abstrack, diskstore_abshead, diskstore_abssector);
+
+      // When reading through the disk, fetch the following track whilst the head is nearby
+      if (sequential)
+      {
+        track=diskstore_abstrack;
+        head=diskstore_abshead;
+
+        if (diskstore_nexttrack(interlacing, maxtracks, &track, &head))
+          diskstore_fetchtrack(track, head);
+      }
     }
 
     if ((curr!=NULL) && (curr->data!=NULL))
     {
+      diskstore_abscurr=curr;
+
       // Prevent reads beyond current sector memory
       if ((diskstore_abssecoffs+toread)>curr->datasize)
         toread=curr->datasize-diskstore_abssecoffs;
@@ -601,6 +960,7 @@ unsigned long diskstore_absoluteread(char *buffer, const unsigned long bufflen,
 void diskstore_init()
 {
   Disk_SectorsRoot=NULL;
+  diskstore_reindex();
 
   diskstore_mintrack=-1;
   diskstore_maxtrack=-1;
@@ -617,5 +977,9 @@ void diskstore_init()
   diskstore_abssecoffs=-1;
   diskstore_absoffset=0;
 
+  memset(diskstore_fetched, DISKSTORE_NOTFETCHED, sizeof(diskstore_fetched));
+  diskstore_lastfetchtrack=-1;
+  diskstore_lastfetchhead=-1;
+
   atexit(diskstore_clearallsectors);
 }
@@ -12,6 +12,27 @@
 #define MODGCR 2
 #define MODAPPLEGCR 3
 
+// Physical tracks which can be indexed, as track numbers are stored in a byte
+#define DISKSTORE_MAXTRACKS 256
+
+// Bytes in a bitmap of logical sector IDs, as sector IDs are stored in a byte
+#define DISKSTORE_SECTORMAPSIZE (256/8)
+
+// Bytes of sector records and data carved from each slab of memory
+#define DISKSTORE_SLABSIZE (64*1024)
+
+// Alignment of everything carved from a slab
+#define DISKSTORE_SLABALIGN 8
+
+// Sizes of sector data, as powers of 2, which are recycled once released
+#define DISKSTORE_MINFREESHIFT 4
+#define DISKSTORE_MAXFREESHIFT 14
+
+// Tracks fetched on demand by absolute reads
+#define DISKSTORE_NOTFETCHED 0
+#define DISKSTORE_FETCHED 1
+#define DISKSTORE_UNREADABLE 2
+
 // Head interlacing types
 #define SEQUENCED 0
 #define INTERLEAVED 1
@@ -41,8 +62,37 @@ typedef struct DiskSector
   unsigned int datacrc;
 
   struct DiskSector *next;
+
+  // Next sector on the same physical track/head
+  struct DiskSector *tracknext;
 } Disk_Sector;
 
+// Sectors stored for one physical track/head, in the same order as the linked list
+typedef struct DiskTrack
+{
+  Disk_Sector *first;
+  Disk_Sector *last;
+  unsigned int count;
+
+  // Logical sector IDs held, all sectors are stored with good data
+  unsigned char sectormap[DISKSTORE_SECTORMAPSIZE];
+} Disk_Track;
+
+// A block of memory which sector records and data are carved from, freed all at once when the store is cleared
+typedef struct DiskSlab
+{
+  struct DiskSlab *next;
+  unsigned long size;
+  unsigned long used;
+  unsigned char *data;
+} Disk_Slab;
+
+// Sector data which has been released, kept to be reused for sectors of the same size
+typedef struct DiskFree
+{
+  struct DiskFree *next;
+} Disk_Free;
+
 // Linked list
 extern Disk_Sector *Disk_SectorsRoot;
 
@@ -60,16 +110,25 @@ extern int diskstore_maxsectorid;
 extern void diskstore_init();
 
 // Add a sector to the disk storage
-extern int diskstore_addsector(const unsigned char modulation, const unsigned char physical_track, const unsigned char physical_head, const unsigned char logical_track, const unsigned char logical_head, const unsigned char logical_sector, const unsigned char logical_size, const long id_pos, const unsigned int idcrc, const long data_pos, const unsigned int datatype, const unsigned int datasize, const unsigned char *data, const unsigned int datacrc);
+extern int diskstore_addsector(const unsigned char modulation, const unsigned char physical_track, const unsigned char physical_head, const unsigned char logical_track, const unsigned char logical_head, const unsigned char logical_sector, const unsigned char logical_size, const long id_pos, const unsigned int idcrc, const long data_pos, const long data_endpos, const unsigned int datatype, const unsigned int datasize, const unsigned char *data, const unsigned int datacrc);
 
 // Search for a sector within the disk storage
 extern Disk_Sector *diskstore_findexactsector(const unsigned char physical_track, const unsigned char physical_head, const unsigned char logical_track, const unsigned char logical_head, const unsigned char logical_sector, const unsigned char logical_size, const unsigned int idcrc, const unsigned int datatype, const unsigned int datasize, const unsigned int datacrc);
 extern Disk_Sector *diskstore_findlogicalsector(const unsigned char logical_track, const unsigned char logical_head, const unsigned char logical_sector);
 extern Disk_Sector *diskstore_findhybridsector(const unsigned char physical_track, const unsigned char physical_head, const unsigned char logical_sector);
+extern Disk_Sector *diskstore_findidsector(const unsigned char physical_track, const unsigned char physical_head, const unsigned char logical_track, const unsigned char logical_head, const unsigned char logical_sector, const unsigned char logical_size, const unsigned int idcrc);
 extern Disk_Sector *diskstore_findnthsector(const unsigned char physical_track, const unsigned char physical_head, const unsigned char nth_sector);
 
+// Check which sectors are held for a physical track/head
+extern int diskstore_hassector(const unsigned char physical_track, const unsigned char physical_head, const unsigned char logical_sector);
+extern int diskstore_hassectors(const unsigned char physical_track, const unsigned char physical_head, const int sectors);
+extern void diskstore_getsectormap(const unsigned char physical_track, const unsigned char physical_head, unsigned char *sectormap);
+extern int diskstore_hassectormap(const unsigned char physical_track, const unsigned char physical_head, const unsigned char *sectormap);
+
 // Processing of sectors
+extern void diskstore_releasetrack(const unsigned char physical_track, const unsigned char physical_head);
 extern unsigned char diskstore_countsectors(const unsigned char physical_track, const unsigned char physical_head);
+extern unsigned char diskstore_countlogicalsectors(const unsigned char physical_track, const unsigned char physical_head);
 extern unsigned int diskstore_countsectormod(const unsigned char modulation);
 extern void diskstore_sortsectors();
 
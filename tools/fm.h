@@ -23,11 +23,35 @@
 #define FM_ADDR 2
 #define FM_DATA 3
 
-extern int fm_idamtrack, fm_idamhead, fm_idamsector, fm_idamlength; 
-extern int fm_lasttrack, fm_lasthead, fm_lastsector, fm_lastlength;
-
-extern void fm_addsample(const unsigned long samples, const unsigned long datapos);
-
-extern void fm_init(const int debug, const char density);
+struct ModContext;
+
+// FM parser state, one per track being decoded
+typedef struct FMContext
+{
+  int state; // state machine
+  unsigned int datacells; // 16 bit sliding buffer
+  int bits; // Number of used bits within sliding buffer
+  unsigned int p1, p2, p3; // bit history
+
+  // Most recent address mark
+  unsigned long idpos, blockpos;
+  int idamtrack, idamhead, idamsector, idamlength; // IDAM values
+  int lasttrack, lasthead, lastsector, lastlength; // last known good IDAM values
+  unsigned char blocktype;
+  unsigned int blocksize;
+  unsigned int idblockcrc, datablockcrc, bitstreamcrc;
+
+  // Output block data buffer, for a single sector
+  unsigned char bitstream[FM_BLOCKSIZE];
+  unsigned int bitlen;
+
+  // FM timings
+  float defaultwindow;
+  float bucket1, bucket01;
+} FM_Context;
+
+extern void fm_addsample(struct ModContext *ctx, const unsigned long samples, const unsigned long datapos);
+
+extern void fm_init(struct ModContext *ctx, const char density);
 
 #endif
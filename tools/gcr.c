@@ -3,6 +3,7 @@
 
 #include "hardware.h"
 #include "diskstore.h"
+#include "mod.h"
 #include "gcr.h"
 
 // GCR for C64
@@ -70,37 +71,16 @@ DATA
 min 4x fillbytes 0x55 (NOT GCR)
 */
 
-unsigned long gcr_bucket1=63;
-unsigned long gcr_bucket01=99;
-
-unsigned char gcr_gcrbuffer[1024*1024];
-int gcr_gcrlen=0;
-
-unsigned char gcr_bytebuffer[1024*1024];
-int gcr_bytelen=0;
-
-int gcr_state=GCR_IDLE; // state machine
-unsigned int gcr_datacells; // 16 bit sliding buffer
-int gcr_bits=0; // Number of used bits within sliding buffer
-
-// Most recent address mark
-unsigned long gcr_idpos, gcr_blockpos;
-int gcr_idamtrack, gcr_idamsector; // IDAM values
-int gcr_lasttrack, gcr_lastsector; // last known good IDAM values
-unsigned int gcr_idblockcrc, gcr_datablockcrc;
-
-int gcr_debug=0;
-
 // Add a 5 bit gcr code to the gcr buffer
-void gcr_addgcr(unsigned char gcr)
+void gcr_addgcr(GCR_Context *gcr, const unsigned char code)
 {
-  gcr_gcrbuffer[gcr_gcrlen++]=gcr;
+  gcr->gcrbuffer[gcr->gcrlen++]=code;
 }
 
 // Decode a 5-bit gcr code to 4 bit binary nibble
-unsigned char gcr_gcrtonibble(unsigned char gcr)
+unsigned char gcr_gcrtonibble(GCR_Context *gcr, const unsigned char code)
 {
-  switch (gcr)
+  switch (code)
   {
     case 0x0a: return 0;
     case 0x0b: return 1;
@@ -121,30 +101,31 @@ unsigned char gcr_gcrtonibble(unsigned char gcr)
   }
 
   // Reset on error
-  gcr_state=GCR_IDLE;
-  gcr_datacells=0;
-  gcr_gcrlen=0;
-  gcr_bytelen=0;
-  gcr_bits=0;
+  gcr->state=GCR_IDLE;
+  gcr->datacells=0;
+  gcr->gcrlen=0;
+  gcr->bytelen=0;
+  gcr->bits=0;
 
   return 0xff;
 }
 
 // Perform an exclusive-or checksum on data
-unsigned char eorsum(int start, int end)
+unsigned char gcr_eorsum(const GCR_Context *gcr, const int start, const int end)
 {
   unsigned char retval=0;
   int i;
 
   for (i=start; i<=end; i++)
-    retval=retval^gcr_bytebuffer[i];
+    retval=retval^gcr->bytebuffer[i];
 
   return retval;
 }
 
 // Decode and process a gcr encoded block
-void gcr_decodegcr()
+void gcr_decodegcr(Mod_Context *ctx, const unsigned long datapos)
 {
+  GCR_Context *gcr=&ctx->gcr;
   int i, j;
   unsigned char enc;
 
@@ -156,9 +137,9 @@ void gcr_decodegcr()
   unsigned char gcrcode=0;
   int codelen=0;
 
-  for (i=0; i<gcr_gcrlen; i++)
+  for (i=0; i<gcr->gcrlen; i++)
   {
-    enc=gcr_gcrbuffer[i];
+    enc=gcr->gcrbuffer[i];
 
     for (j=0; j<8; j++)
     {
@@ -169,7 +150,7 @@ void gcr_decodegcr()
 
       if (codelen==5)
       {
-        unsigned char nibble=gcr_gcrtonibble(gcrcode);
+        unsigned char nibble=gcr_gcrtonibble(gcr, gcrcode);
 
         // Stop processing on GCR error
         if (nibble==0xff)
@@ -187,7 +168,7 @@ void gcr_decodegcr()
         {
           byteval=(byteval<<4)|nibble;
 
-          gcr_bytebuffer[gcr_bytelen++]=byteval;
+          gcr->bytebuffer[gcr->bytelen++]=byteval;
 
           n=0;
         }
@@ -201,82 +182,82 @@ void gcr_decodegcr()
 
   // Dump
 /*
-  if (gcr_debug)
+  if (ctx->debug)
   {
-    for (i=0; i<gcr_bytelen; i++)
-      fprintf(stderr, "%.2x ", gcr_bytebuffer[i]);
+    for (i=0; i<gcr->bytelen; i++)
+      fprintf(stderr, "%.2x ", gcr->bytebuffer[i]);
 
     fprintf(stderr, "\n");
   }
 */
 
-  if (gcr_bytebuffer[0]==0x08)
+  if (gcr->bytebuffer[0]==0x08)
   {
-    eorcalc=eorsum(2, 5);
+    eorcalc=gcr_eorsum(gcr, 2, 5);
 
     // Check the checksum matches before processing
-    if (gcr_bytebuffer[1]==eorcalc)
+    if (gcr->bytebuffer[1]==eorcalc)
     {
-      if (gcr_debug)
+      if (ctx->debug)
       {
-        printf("\n  Header : %.2x", gcr_bytebuffer[0]);
-        printf("  Checksum : %.2x", gcr_bytebuffer[1]);
-        printf("  Sector : %.2d", gcr_bytebuffer[2]);
-        printf("  Track : %.2d", gcr_bytebuffer[3]);
-        printf("  ID2 : %.2x", gcr_bytebuffer[4]);
-        printf("  ID1 : %.2x", gcr_bytebuffer[5]);
-        printf("  OF : %.2x", gcr_bytebuffer[6]);
-        printf("  OF : %.2x", gcr_bytebuffer[7]);
+        printf("\n  Header : %.2x", gcr->bytebuffer[0]);
+        printf("  Checksum : %.2x", gcr->bytebuffer[1]);
+        printf("  Sector : %.2d", gcr->bytebuffer[2]);
+        printf("  Track : %.2d", gcr->bytebuffer[3]);
+        printf("  ID2 : %.2x", gcr->bytebuffer[4]);
+        printf("  ID1 : %.2x", gcr->bytebuffer[5]);
+        printf("  OF : %.2x", gcr->bytebuffer[6]);
+        printf("  OF : %.2x", gcr->bytebuffer[7]);
 
         printf("  [OK]\n");
       }
 
-      gcr_idamtrack=gcr_bytebuffer[3];
-      gcr_idamsector=gcr_bytebuffer[2];
+      gcr->idamtrack=gcr->bytebuffer[3];
+      gcr->idamsector=gcr->bytebuffer[2];
 
       // Record last known good IDAM values for this track
-      gcr_lasttrack=gcr_idamtrack;
-      gcr_lastsector=gcr_idamsector;
+      gcr->lasttrack=gcr->idamtrack;
+      gcr->lastsector=gcr->idamsector;
 
-      gcr_idblockcrc=gcr_bytebuffer[1];
+      gcr->idblockcrc=gcr->bytebuffer[1];
     }
     else
     {
-      if (gcr_debug)
-        printf("\n** INVALID ID EORSUM [%.2x] (%.2x)\n", gcr_bytebuffer[1], eorcalc);
+      if (ctx->debug)
+        printf("\n** INVALID ID EORSUM [%.2x] (%.2x)\n", gcr->bytebuffer[1], eorcalc);
     }
   }
   else
-  if (gcr_bytebuffer[0]==0x07)
+  if (gcr->bytebuffer[0]==0x07)
   {
-    eorcalc=eorsum(1, GCR_SECTORLEN);
+    eorcalc=gcr_eorsum(gcr, 1, GCR_SECTORLEN);
 
     // Check the checksum matches before processing
-    if (gcr_bytebuffer[GCR_SECTORLEN+1]==eorcalc)
+    if (gcr->bytebuffer[GCR_SECTORLEN+1]==eorcalc)
     {
-      if (gcr_debug)
+      if (ctx->debug)
       {
         printf("\nDATA EORSUM OK\n");
         printf("*** GCR good sector");
-        if ((gcr_idamtrack!=-1) && (gcr_idamsector!=-1))
-          printf(" T%d S%d", gcr_idamtrack, gcr_idamsector);
+        if ((gcr->idamtrack!=-1) && (gcr->idamsector!=-1))
+          printf(" T%d S%d", gcr->idamtrack, gcr->idamsector);
 
         printf(" ***\n");
       }
 
-      gcr_datablockcrc=gcr_bytebuffer[GCR_SECTORLEN+1];
+      gcr->datablockcrc=gcr->bytebuffer[GCR_SECTORLEN+1];
 
-      if ((gcr_idamtrack!=-1) && (gcr_idamsector!=-1))
+      if ((gcr->idamtrack!=-1) && (gcr->idamsector!=-1))
       {
-        diskstore_addsector(MODGCR, hw_currenttrack, hw_currenthead, gcr_idamtrack, hw_currenthead, gcr_idamsector, 1, gcr_idpos, gcr_idblockcrc, gcr_blockpos, gcr_bytebuffer[0], GCR_SECTORLEN, &gcr_bytebuffer[1], gcr_datablockcrc);
+        ctx->addsector(ctx, MODGCR, gcr->idamtrack, ctx->head, gcr->idamsector, 1, gcr->idpos, gcr->idblockcrc, gcr->blockpos, datapos, gcr->bytebuffer[0], GCR_SECTORLEN, &gcr->bytebuffer[1], gcr->datablockcrc);
       }
       else
       {
-        if (gcr_debug)
+        if (ctx->debug)
         {
           printf("\n** VALID DATA BUT INVALID ID");
-          if ((gcr_lasttrack!=-1) && (gcr_lastsector!=-1))
-            printf(", last found ID was T%d S%d", gcr_lasttrack, gcr_lastsector);
+          if ((gcr->lasttrack!=-1) && (gcr->lastsector!=-1))
+            printf(", last found ID was T%d S%d", gcr->lasttrack, gcr->lastsector);
 
           printf(" **\n");
         }
@@ -284,173 +265,180 @@ void gcr_decodegcr()
     }
     else
     {
-      if (gcr_debug)
+      if (ctx->debug)
       {
-        printf("\n** INVALID DATA EORSUM [%.2x] (%.2x)", gcr_bytebuffer[GCR_SECTORLEN+1], eorcalc);
-        if ((gcr_idamtrack!=-1) && (gcr_idamsector!=-1))
-          printf(", possibly for T%d S%d", gcr_idamtrack, gcr_idamsector);
+        printf("\n** INVALID DATA EORSUM [%.2x] (%.2x)", gcr->bytebuffer[GCR_SECTORLEN+1], eorcalc);
+        if ((gcr->idamtrack!=-1) && (gcr->idamsector!=-1))
+          printf(", possibly for T%d S%d", gcr->idamtrack, gcr->idamsector);
 
         printf(" **\n");
       }
     }
 
     // Clear IDAM cache
-    gcr_idamtrack=-1;
-    gcr_idamsector=-1;
+    gcr->idamtrack=-1;
+    gcr->idamsector=-1;
   }
 
-  gcr_bytelen=0;
+  gcr->bytelen=0;
 }
 
-void gcr_addbit(const unsigned char bit, const unsigned long datapos)
+void gcr_addbit(Mod_Context *ctx, const unsigned char bit, const unsigned long datapos)
 {
-  gcr_datacells=((gcr_datacells<<1)&0xffff);
-  gcr_datacells|=bit;
-  gcr_bits++;
+  GCR_Context *gcr=&ctx->gcr;
+
+  gcr->datacells=((gcr->datacells<<1)&0xffff);
+  gcr->datacells|=bit;
+  gcr->bits++;
 
-  switch (gcr_state)
+  switch (gcr->state)
   {
     case GCR_IDLE:
-      if (gcr_bits>=16)
+      if (gcr->bits>=16)
       {
-        if (gcr_datacells==0xff52) // ID
+        if (gcr->datacells==0xff52) // ID
         {
-          if (gcr_debug)
+          if (ctx->debug)
             fprintf(stderr, "[%lx] GCR ID\n", datapos);
 
-          gcr_gcrlen=0;
-          gcr_addgcr(gcr_datacells & 0xff);
+          gcr->gcrlen=0;
+          gcr_addgcr(gcr, gcr->datacells & 0xff);
 
-          gcr_idpos=datapos;
-          gcr_state=GCR_ID;
+          gcr->idpos=datapos;
+          gcr->state=GCR_ID;
 
-          gcr_datacells=0;
-          gcr_bits=0;
+          gcr->datacells=0;
+          gcr->bits=0;
 
           // Clear IDAM cache incase previous was good and this one is bad
-          gcr_idamtrack=-1;
-          gcr_idamsector=-1;
+          gcr->idamtrack=-1;
+          gcr->idamsector=-1;
         }
         else
-        if (gcr_datacells==0xff55) // DATA
+        if (gcr->datacells==0xff55) // DATA
         {
-          if (gcr_debug)
+          if (ctx->debug)
             fprintf(stderr, "[%lx] GCR DATA\n", datapos);
 
-          gcr_gcrlen=0;
-          gcr_addgcr(gcr_datacells & 0xff);
+          gcr->gcrlen=0;
+          gcr_addgcr(gcr, gcr->datacells & 0xff);
 
-          gcr_blockpos=datapos;
-          gcr_state=GCR_DATA;
+          gcr->blockpos=datapos;
+          gcr->state=GCR_DATA;
 
-          gcr_datacells=0;
-          gcr_bits=0;
+          gcr->datacells=0;
+          gcr->bits=0;
         }
       }
       break;
 
     case GCR_ID:
-      if (gcr_bits>=8)
+      if (gcr->bits>=8)
       {
-        gcr_addgcr(gcr_datacells & 0xff);
+        gcr_addgcr(gcr, gcr->datacells & 0xff);
 
-        gcr_bits=0;
-        gcr_datacells=0;
+        gcr->bits=0;
+        gcr->datacells=0;
 
         // Check for 10 encoded gcr
-        if (gcr_gcrlen==10)
+        if (gcr->gcrlen==10)
         {
-          gcr_decodegcr();
+          gcr_decodegcr(ctx, datapos);
 
-          gcr_state=GCR_IDLE;
+          gcr->state=GCR_IDLE;
         }
       }
       break;
 
     case GCR_DATA:
-      if (gcr_bits>=8)
+      if (gcr->bits>=8)
       {
-        gcr_addgcr(gcr_datacells & 0xff);
+        gcr_addgcr(gcr, gcr->datacells & 0xff);
 
-        gcr_bits=0;
-        gcr_datacells=0;
+        gcr->bits=0;
+        gcr->datacells=0;
 
         // Check for 325 encoded gcr
-        if (gcr_gcrlen==325)
+        if (gcr->gcrlen==325)
         {
-          gcr_decodegcr();
+          gcr_decodegcr(ctx, datapos);
 
-          gcr_state=GCR_IDLE;
+          gcr->state=GCR_IDLE;
         }
       }
       break;
 
     default:
-      gcr_state=GCR_IDLE;
+      gcr->state=GCR_IDLE;
       break;
   }
 }
 
-void gcr_addsample(const unsigned long samples, const unsigned long datapos)
+void gcr_addsample(Mod_Context *ctx, const unsigned long samples, const unsigned long datapos)
 {
-  if (hw_currenttrack<=(17*2))
+  GCR_Context *gcr=&ctx->gcr;
+
+  if (ctx->track<=(17*2))
   {
-    gcr_bucket1=63;
-    gcr_bucket01=99;
+    gcr->bucket1=63;
+    gcr->bucket01=99;
   }
   else
-  if (hw_currenttrack<=(24*2))
+  if (ctx->track<=(24*2))
   {
-    gcr_bucket1=66;
-    gcr_bucket01=106;
+    gcr->bucket1=66;
+    gcr->bucket01=106;
   }
   else
-  if (hw_currenttrack<=(30*2))
+  if (ctx->track<=(30*2))
   {
-    gcr_bucket1=71;
-    gcr_bucket01=114;
+    gcr->bucket1=71;
+    gcr->bucket01=114;
   }
   else
   {
-    gcr_bucket1=77;
-    gcr_bucket01=122;
+    gcr->bucket1=77;
+    gcr->bucket01=122;
   }
 
-  if (samples<=gcr_bucket1)
+  if (samples<=gcr->bucket1)
   {
-    gcr_addbit(1, datapos);
+    gcr_addbit(ctx, 1, datapos);
   }
   else
-  if (samples<=gcr_bucket01)
+  if (samples<=gcr->bucket01)
   {
-    gcr_addbit(0, datapos);
-    gcr_addbit(1, datapos);
+    gcr_addbit(ctx, 0, datapos);
+    gcr_addbit(ctx, 1, datapos);
   }
   else
   {
-    gcr_addbit(0, datapos);
-    gcr_addbit(0, datapos);
-    gcr_addbit(1, datapos);
+    gcr_addbit(ctx, 0, datapos);
+    gcr_addbit(ctx, 0, datapos);
+    gcr_addbit(ctx, 1, datapos);
   }
 }
 
-void gcr_init(const int debug, const char density)
+void gcr_init(Mod_Context *ctx, const char density)
 {
-  gcr_debug=debug;
+  GCR_Context *gcr=&ctx->gcr;
 
   // Set up C64 GCR parser
-  gcr_state=GCR_IDLE;
-  gcr_bits=0;
-  gcr_datacells=0;
+  gcr->state=GCR_IDLE;
+  gcr->bits=0;
+  gcr->datacells=0;
+
+  gcr->gcrlen=0;
+  gcr->bytelen=0;
 
-  gcr_idpos=0;
-  gcr_blockpos=0;
+  gcr->idpos=0;
+  gcr->blockpos=0;
 
   // Initialise last found sector IDAM to invalid
-  gcr_idamtrack=-1;
-  gcr_idamsector=-1;
+  gcr->idamtrack=-1;
+  gcr->idamsector=-1;
 
   // Initialise last known good sector IDAM to invalid
-  gcr_lasttrack=-1;
-  gcr_lastsector=-1;
+  gcr->lasttrack=-1;
+  gcr->lastsector=-1;
 }
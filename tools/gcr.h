@@ -8,11 +8,36 @@
 
 #define GCR_SECTORLEN 256
 
-extern int gcr_idamtrack, gcr_idamsector;
-extern int gcr_lasttrack, gcr_lastsector;
+// Largest GCR block is 325 encoded bytes
+#define GCR_BUFFERSIZE 1024
 
-extern void gcr_addsample(const unsigned long samples, const unsigned long datapos);
+struct ModContext;
 
-extern void gcr_init(const int debug, const char density);
+// C64 GCR parser state, one per track being decoded
+typedef struct GCRContext
+{
+  unsigned long bucket1;
+  unsigned long bucket01;
+
+  unsigned char gcrbuffer[GCR_BUFFERSIZE];
+  int gcrlen;
+
+  unsigned char bytebuffer[GCR_BUFFERSIZE];
+  int bytelen;
+
+  int state; // state machine
+  unsigned int datacells; // 16 bit sliding buffer
+  int bits; // Number of used bits within sliding buffer
+
+  // Most recent address mark
+  unsigned long idpos, blockpos;
+  int idamtrack, idamsector; // IDAM values
+  int lasttrack, lastsector; // last known good IDAM values
+  unsigned int idblockcrc, datablockcrc;
+} GCR_Context;
+
+extern void gcr_addsample(struct ModContext *ctx, const unsigned long samples, const unsigned long datapos);
+
+extern void gcr_init(struct ModContext *ctx, const char density);
 
 #endif
@@ -13,6 +13,8 @@ float hw_rpm = HW_DEFAULTRPM;
 
 int hw_stepping = HW_NORMALSTEPPING;
 
+int hw_spisamples = 1;
+
 // Initialise GPIO and SPI
 int hw_init(const int spiclockdivider)
 {
@@ -131,6 +133,8 @@ void hw_done()
   hw_stopmotor();
   bcm2835_spi_end();
   bcm2835_close();
+
+  hw_freebuffers();
 }
 
 // Determine if head is at track zero
@@ -344,70 +348,110 @@ void hw_sideselect(const int side)
   }
 }
 
-// Fix SPI sample buffer timings
-void hw_fixspisamples(char *inbuf, long inlen, char *outbuf, long outlen)
+// Fix SPI sample buffer timings in place, expanding the inlen bytes sampled at the start of buf to fill up to outlen bytes
+void hw_fixspisamples(char *buf, const long inlen, const long outlen)
 {
-  long inpos, outpos;
-  unsigned char c, o, olen, bitpos;
-
-  outpos=0; o=0; olen=0;
-
-  for (inpos=0; inpos<inlen; inpos++)
+  unsigned char samples[BITSPERBYTE];
+  unsigned char fixed[BITSPERBYTE+1];
+  long group, inpos, outpos;
+  unsigned int o, olen;
+  int i, ilen, flen;
+
+  // Each group of 8 bytes sampled becomes 9 bytes, so work back from the end to avoid overwriting samples not yet fixed
+  for (group=(inlen+(BITSPERBYTE-1))/BITSPERBYTE; group>0; group--)
   {
-    c=inbuf[inpos];
+    inpos=(group-1)*BITSPERBYTE;
+    outpos=(group-1)*(BITSPERBYTE+1);
 
-    // Insert extra sample, this is due to SPI sampling leaving a 1 sample gap between each group of 8 samples
-    o=(o<<1)|((c&0x80)>>7);
-    olen++;
-    if (olen==BITSPERBYTE)
-    {
-      if (outpos<outlen)
-        outbuf[outpos++]=o;
+    // Stop on output buffer overflow
+    if (outpos>=outlen) continue;
 
-      olen=0; o=0;
-    }
+    ilen=((inlen-inpos)<BITSPERBYTE)?(inlen-inpos):BITSPERBYTE;
+    for (i=0; i<ilen; i++)
+      samples[i]=buf[inpos+i];
 
-    // Process the 8 valid samples we did get
-    for (bitpos=0; bitpos<BITSPERBYTE; bitpos++)
+    o=0; olen=0; flen=0;
+
+    for (i=0; i<ilen; i++)
     {
-      o=(o<<1)|((c&0x80)>>7);
-      olen++;
+      // Insert extra sample, this is due to SPI sampling leaving a 1 sample gap between each group of 8 samples
+      o=(o<<(BITSPERBYTE+1))|((samples[i]&0x80)<<1)|samples[i];
+      olen+=(BITSPERBYTE+1);
 
-      if (olen==BITSPERBYTE)
+      while (olen>=BITSPERBYTE)
       {
-        if (outpos<outlen)
-          outbuf[outpos++]=o;
-
-        olen=0; o=0;
+        olen-=BITSPERBYTE;
+        fixed[flen++]=(o>>olen)&0xff;
       }
-
-      c=c<<1;
     }
 
-    // Stop on output buffer overflow
-    if (outpos>=outlen) return;
+    for (i=0; (i<flen) && ((outpos+i)<outlen); i++)
+      buf[outpos+i]=fixed[i];
   }
 }
 
 // Sample raw track data
 void hw_samplerawtrackdata(char* buf, uint32_t len)
 {
-  char *rawbuf;
+  hw_samplerawtrackchunk(buf, len, 0, len);
+}
+
+// Sample raw track data a chunk at a time, returns how much of the buffer has been filled so far
+//   there will be a short gap in the samples between chunks, whilst each SPI transfer is set up
+uint32_t hw_samplerawtrackchunk(char* buf, uint32_t len, uint32_t filled, uint32_t chunklen)
+{
+  uint32_t rawlen;
 
-  // Clear output buffer to prevent failed reads potentially returning previous data
-  bzero(buf, len);
+  // Start a new capture
+  if (filled==0)
+    hw_waitforindex();
 
-  rawbuf=malloc(len);
-  if (rawbuf==NULL) return;
+  if (filled>=len)
+    return len;
+
+  // Each group of 8 bytes sampled by SPI becomes 9 bytes once fixed, so sample whole groups
+  rawlen=((chunklen+BITSPERBYTE)/(BITSPERBYTE+1))*BITSPERBYTE;
+  if (rawlen==0) rawlen=BITSPERBYTE;
+
+  // Samples are fixed where they land, so they must fit before being expanded
+  if ((filled+rawlen)>len)
+    rawlen=len-filled;
 
   // Sample using SPI
-  hw_waitforindex();
-  bcm2835_spi_transfern(rawbuf, len);
+  bcm2835_spi_transfern(&buf[filled], rawlen);
 
   // Fix SPI timings
-  hw_fixspisamples(rawbuf, len, buf, len);
+  hw_fixspisamples(&buf[filled], rawlen, len-filled);
+
+  filled+=(rawlen*(BITSPERBYTE+1))/BITSPERBYTE;
+
+  return (filled<len)?filled:len;
+}
+
+// Sample raw track data a chunk at a time, leaving the samples as sampled by SPI, returns how much of the buffer has been filled so far
+//   chunklen is in bytes of fixed samples, each byte sampled by SPI covers 9 samples so fewer bytes are needed
+uint32_t hw_samplespitrackchunk(char* buf, uint32_t len, uint32_t filled, uint32_t chunklen)
+{
+  uint32_t rawlen;
+
+  // Start a new capture
+  if (filled==0)
+    hw_waitforindex();
+
+  if (filled>=len)
+    return len;
+
+  // Sample whole groups of 8 bytes, the same as when samples are fixed
+  rawlen=((chunklen+BITSPERBYTE)/(BITSPERBYTE+1))*BITSPERBYTE;
+  if (rawlen==0) rawlen=BITSPERBYTE;
+
+  if ((filled+rawlen)>len)
+    rawlen=len-filled;
+
+  // Sample using SPI
+  bcm2835_spi_transfern(&buf[filled], rawlen);
 
-  free(rawbuf);
+  return filled+rawlen;
 }
 
 void hw_sleep(const unsigned int seconds)
@@ -2,6 +2,7 @@
 #define _HARDWARE_H_
 
 #include <stdint.h>
+#include <stdio.h>
 
 // For disk/drive status
 #define HW_NODRIVE 0
@@ -47,6 +48,17 @@
 #define HW_400MHZ 400000000
 #define HW_500MHZ 500000000
 
+// Most capture buffers which can be in use at once, enough for one per decoding thread (up to 64) when reading a file
+#define HW_MAXBUFFERS (4+64)
+
+// A capture buffer, kept for reuse once released
+typedef struct HWBuffer
+{
+  char *data;
+  uint32_t len;
+  int inuse;
+} HW_Buffer;
+
 extern unsigned int hw_maxtracks;
 extern unsigned int hw_currenttrack;
 extern unsigned int hw_currenthead;
@@ -55,6 +67,16 @@ extern float hw_rpm;
 
 extern int hw_stepping;
 
+// Set when hw_samplespitrackchunk() gives samples as sampled by SPI, which have not been fixed
+extern int hw_spisamples;
+
+extern unsigned long hw_allocations;
+
+#ifdef NOPI
+// Milliseconds a virtual capture takes per rotation sampled, including reading the sample file
+extern unsigned int hw_rotationdelay;
+#endif
+
 // Initialisation
 #ifdef NOPI
 extern int hw_init(const char *rawfile, const int spiclockdivider);
@@ -81,9 +103,22 @@ extern void hw_seekout();
 extern void hw_waitforindex();
 extern int hw_writeprotected();
 extern void hw_samplerawtrackdata(char* buf, uint32_t len);
+extern uint32_t hw_samplerawtrackchunk(char* buf, uint32_t len, uint32_t filled, uint32_t chunklen);
+extern uint32_t hw_samplespitrackchunk(char* buf, uint32_t len, uint32_t filled, uint32_t chunklen);
+#ifdef NOPI
+extern FILE *hw_opensamplefile();
+extern void hw_samplefiletrack(FILE *samplefile, const unsigned int track, const unsigned int head, char* buf, uint32_t len);
+extern const unsigned char *hw_samplefilerle(FILE *samplefile, const unsigned int track, const unsigned int head, unsigned long *rlelen);
+extern uint32_t hw_samplerletrackchunk(const unsigned char **rledata, unsigned long *rlelen, uint32_t len, uint32_t filled, uint32_t chunklen);
+#endif
 extern void hw_sleep(const unsigned int seconds);
 extern float hw_measurerpm();
-extern void hw_fixspisamples(char *inbuf, long inlen, char *outbuf, long outlen);
+extern void hw_fixspisamples(char *buf, const long inlen, const long outlen);
+
+// Capture buffers
+extern char *hw_acquirebuffer(const uint32_t len);
+extern void hw_releasebuffer(const char *data);
+extern void hw_freebuffers();
 
 // Clean up
 extern void hw_done();
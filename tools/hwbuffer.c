@@ -0,0 +1,87 @@
+#include <stdlib.h>
+
+#include "hardware.h"
+
+// Capture buffers, kept once allocated so tracks can be sampled again without allocating more memory
+HW_Buffer hw_buffers[HW_MAXBUFFERS];
+
+// Number of times a capture buffer has had to be allocated
+unsigned long hw_allocations = 0;
+
+// Get a capture buffer of at least the given length, reusing one released earlier if possible
+char *hw_acquirebuffer(const uint32_t len)
+{
+  HW_Buffer *buffer;
+  int i;
+
+  // Look for a free buffer which is already big enough
+  for (i=0; i<HW_MAXBUFFERS; i++)
+  {
+    buffer=&hw_buffers[i];
+
+    if ((buffer->inuse==0) && (buffer->data!=NULL) && (buffer->len>=len))
+    {
+      buffer->inuse=1;
+
+      return buffer->data;
+    }
+  }
+
+  // Otherwise replace a free buffer which is too small, or use an empty slot
+  for (i=0; i<HW_MAXBUFFERS; i++)
+  {
+    buffer=&hw_buffers[i];
+
+    if (buffer->inuse==0)
+    {
+      if (buffer->data!=NULL)
+        free(buffer->data);
+
+      buffer->data=malloc(len);
+      buffer->len=(buffer->data==NULL)?0:len;
+
+      if (buffer->data==NULL)
+        return NULL;
+
+      buffer->inuse=1;
+      hw_allocations++;
+
+      return buffer->data;
+    }
+  }
+
+  return NULL;
+}
+
+// Return a capture buffer so it can be reused
+void hw_releasebuffer(const char *data)
+{
+  int i;
+
+  if (data==NULL) return;
+
+  for (i=0; i<HW_MAXBUFFERS; i++)
+  {
+    if (hw_buffers[i].data==data)
+    {
+      hw_buffers[i].inuse=0;
+      return;
+    }
+  }
+}
+
+// Free all the capture buffers
+void hw_freebuffers()
+{
+  int i;
+
+  for (i=0; i<HW_MAXBUFFERS; i++)
+  {
+    if (hw_buffers[i].data!=NULL)
+      free(hw_buffers[i].data);
+
+    hw_buffers[i].data=NULL;
+    hw_buffers[i].len=0;
+    hw_buffers[i].inuse=0;
+  }
+}
@@ -6,75 +6,53 @@
 #include "mod.h"
 #include "mfm.h"
 
-int mfm_state=MFM_SYNC; // state machine
-unsigned int mfm_datacells=0; // 16 bit sliding buffer
-int mfm_bits=0; // Number of used bits within sliding buffer
-unsigned int mfm_p1, mfm_p2, mfm_p3=0; // bit history
-
-// Most recent address mark
-unsigned long mfm_idpos, mfm_blockpos;
-int mfm_idamtrack, mfm_idamhead, mfm_idamsector, mfm_idamlength; // IDAM values
-int mfm_lasttrack, mfm_lasthead, mfm_lastsector, mfm_lastlength;
-unsigned char mfm_blocktype;
-unsigned int mfm_blocksize;
-unsigned int mfm_idblockcrc, mfm_datablockcrc, mfm_bitstreamcrc;
-
-// Output block data buffer, for a single sector
-unsigned char mfm_bitstream[MFM_BLOCKSIZE];
-unsigned int mfm_bitlen=0;
-
-// MFM timings
-float mfm_defaultwindow;
-float mfm_bucket01, mfm_bucket001, mfm_bucket0001;
-
-int mfm_debug=0;
-
 // Add a bit to the 16-bit accumulator, when full - attempt to process (clock + data)
-void mfm_addbit(const unsigned char bit, const unsigned long datapos)
+void mfm_addbit(Mod_Context *ctx, const unsigned char bit, const unsigned long datapos)
 {
+  MFM_Context *mfm=&ctx->mfm;
   unsigned char clock, data;
   unsigned char dataCRC; // EDC
 
   // Maintain previous 48 bits of data
-  mfm_p1=((mfm_p1<<1)|((mfm_p2&0x8000)>>15))&0xffff;
-  mfm_p2=((mfm_p2<<1)|((mfm_p3&0x8000)>>15))&0xffff;
-  mfm_p3=((mfm_p3<<1)|((mfm_datacells&0x8000)>>15))&0xffff;
+  mfm->p1=((mfm->p1<<1)|((mfm->p2&0x8000)>>15))&0xffff;
+  mfm->p2=((mfm->p2<<1)|((mfm->p3&0x8000)>>15))&0xffff;
+  mfm->p3=((mfm->p3<<1)|((mfm->datacells&0x8000)>>15))&0xffff;
 
-  mfm_datacells=((mfm_datacells<<1)&0xffff);
-  mfm_datacells|=bit;
-  mfm_bits++;
+  mfm->datacells=((mfm->datacells<<1)&0xffff);
+  mfm->datacells|=bit;
+  mfm->bits++;
 
-  if (mfm_bits>=16)
+  if (mfm->bits>=16)
   {
     // Extract clock byte
-    clock=mod_getclock(mfm_datacells);
+    clock=mod_getclock(mfm->datacells);
 
     // Extract data byte
-    data=mod_getdata(mfm_datacells);
+    data=mod_getdata(mfm->datacells);
 
-    switch (mfm_state)
+    switch (mfm->state)
     {
       case MFM_SYNC:
-        if (mfm_datacells==0x5224)
+        if (mfm->datacells==0x5224)
         {
-          if (mfm_debug)
+          if (ctx->debug)
             fprintf(stderr, "[%lx] ==MFM IAM SYNC 5224==\n", datapos);
 
-          mfm_bits=16; // Keep looking for sync (preventing overflow)
+          mfm->bits=16; // Keep looking for sync (preventing overflow)
         }
         else
-        if (mfm_datacells==0x4489)
+        if (mfm->datacells==0x4489)
         {
-          if (mfm_debug)
+          if (ctx->debug)
             fprintf(stderr, "[%lx] ==MFM IDAM/DAM SYNC 4489==\n", datapos);
 
-          mfm_bits=0;
-          mfm_bitlen=0; // Clear output buffer
+          mfm->bits=0;
+          mfm->bitlen=0; // Clear output buffer
 
-          mfm_state=MFM_MARK; // Move on to look for MFM address mark
+          mfm->state=MFM_MARK; // Move on to look for MFM address mark
         }
         else
-          mfm_bits=16; // Keep looking for sync (preventing overflow)
+          mfm->bits=16; // Keep looking for sync (preventing overflow)
         break;
 
       case MFM_MARK:
@@ -84,28 +62,28 @@ void mfm_addbit(const unsigned char bit, const unsigned long datapos)
           case MFM_ALTBLOCKADDR: // ff - Alternative IDAM
           case M2FM_BLOCKADDR: // 0e - Intel M2FM IDAM
           case M2FM_HPBLOCKADDR: // 70 - HP M2FM IDAM
-            if (mfm_debug)
+            if (ctx->debug)
               fprintf(stderr, "[%lx] MFM ID Address Mark %.2x\n", datapos, data);
 
-            mfm_bits=0;
-            mfm_blocktype=data;
+            mfm->bits=0;
+            mfm->blocktype=data;
 
-            mfm_bitlen=0;
-            mfm_bitstream[mfm_bitlen++]=mod_getdata(mfm_p1);
-            mfm_bitstream[mfm_bitlen++]=mod_getdata(mfm_p2);
-            mfm_bitstream[mfm_bitlen++]=mod_getdata(mfm_p3);
-            mfm_bitstream[mfm_bitlen++]=data;
+            mfm->bitlen=0;
+            mfm->bitstream[mfm->bitlen++]=mod_getdata(mfm->p1);
+            mfm->bitstream[mfm->bitlen++]=mod_getdata(mfm->p2);
+            mfm->bitstream[mfm->bitlen++]=mod_getdata(mfm->p3);
+            mfm->bitstream[mfm->bitlen++]=data;
 
-            mfm_blocksize=3+1+4+2;
+            mfm->blocksize=3+1+4+2;
 
             // Clear IDAM cache incase previous was good and this one is bad
-            mfm_idamtrack=-1;
-            mfm_idamhead=-1;
-            mfm_idamsector=-1;
-            mfm_idamlength=-1;
+            mfm->idamtrack=-1;
+            mfm->idamhead=-1;
+            mfm->idamsector=-1;
+            mfm->idamlength=-1;
 
-            mfm_idpos=datapos;
-            mfm_state=MFM_ADDR;
+            mfm->idpos=datapos;
+            mfm->state=MFM_ADDR;
             break;
 
           case MFM_BLOCKDATA: // fb - DAM
@@ -113,109 +91,109 @@ void mfm_addbit(const unsigned char bit, const unsigned long datapos)
           case MFM_RX02BLOCKDATA: // fd - RX02 M2FM DAM
           case M2FM_BLOCKDATA: // 0b - Intel M2FM DAM
           case M2FM_HPBLOCKDATA: // 50 - HP M2FM DAM
-            if (mfm_debug)
+            if (ctx->debug)
               fprintf(stderr, "[%lx] MFM Data Address Mark %.2x\n", datapos, data);
 
             // Don't process if don't have a valid preceding IDAM
-            if ((mfm_idamtrack!=-1) && (mfm_idamhead!=-1) && (mfm_idamsector!=-1) && (mfm_idamlength!=-1))
+            if ((mfm->idamtrack!=-1) && (mfm->idamhead!=-1) && (mfm->idamsector!=-1) && (mfm->idamlength!=-1))
             {
-              mfm_bits=0;
-              mfm_blocktype=data;
+              mfm->bits=0;
+              mfm->blocktype=data;
 
-              mfm_bitlen=0;
-              mfm_bitstream[mfm_bitlen++]=mod_getdata(mfm_p1);
-              mfm_bitstream[mfm_bitlen++]=mod_getdata(mfm_p2);
-              mfm_bitstream[mfm_bitlen++]=mod_getdata(mfm_p3);
-              mfm_bitstream[mfm_bitlen++]=data;
+              mfm->bitlen=0;
+              mfm->bitstream[mfm->bitlen++]=mod_getdata(mfm->p1);
+              mfm->bitstream[mfm->bitlen++]=mod_getdata(mfm->p2);
+              mfm->bitstream[mfm->bitlen++]=mod_getdata(mfm->p3);
+              mfm->bitstream[mfm->bitlen++]=data;
 
-              mfm_blockpos=datapos;
-              mfm_state=MFM_DATA;
+              mfm->blockpos=datapos;
+              mfm->state=MFM_DATA;
             }
             else
             {
-              mfm_blocktype=MFM_BLOCKNULL;
-              mfm_bitlen=0;
-              mfm_state=MFM_SYNC;
+              mfm->blocktype=MFM_BLOCKNULL;
+              mfm->bitlen=0;
+              mfm->state=MFM_SYNC;
             }
             break;
 
           case MFM_BLOCKDELDATA: // f8 - DDAM
           case MFM_ALTBLOCKDELDATA: // f9 - Alternative DDAM
           case M2FM_BLOCKDELDATA: // 08 - Intel M2FM DDAM
-            if (mfm_debug)
+            if (ctx->debug)
               fprintf(stderr, "[%lx] MFM Deleted Data Address Mark %.2x\n", datapos, data);
 
             // Don't process if don't have a valid preceding IDAM
-            if ((mfm_idamtrack!=-1) && (mfm_idamhead!=-1) && (mfm_idamsector!=-1) && (mfm_idamlength!=-1))
+            if ((mfm->idamtrack!=-1) && (mfm->idamhead!=-1) && (mfm->idamsector!=-1) && (mfm->idamlength!=-1))
             {
-              mfm_bits=0;
-              mfm_blocktype=data;
+              mfm->bits=0;
+              mfm->blocktype=data;
 
-              mfm_bitlen=0;
-              mfm_bitstream[mfm_bitlen++]=mod_getdata(mfm_p1);
-              mfm_bitstream[mfm_bitlen++]=mod_getdata(mfm_p2);
-              mfm_bitstream[mfm_bitlen++]=mod_getdata(mfm_p3);
-              mfm_bitstream[mfm_bitlen++]=data;
+              mfm->bitlen=0;
+              mfm->bitstream[mfm->bitlen++]=mod_getdata(mfm->p1);
+              mfm->bitstream[mfm->bitlen++]=mod_getdata(mfm->p2);
+              mfm->bitstream[mfm->bitlen++]=mod_getdata(mfm->p3);
+              mfm->bitstream[mfm->bitlen++]=data;
 
-              mfm_blockpos=datapos;
-              mfm_state=MFM_DATA;
+              mfm->blockpos=datapos;
+              mfm->state=MFM_DATA;
             }
             else
             {
-              mfm_blocktype=MFM_BLOCKNULL;
-              mfm_bitlen=0;
-              mfm_state=MFM_SYNC;
+              mfm->blocktype=MFM_BLOCKNULL;
+              mfm->bitlen=0;
+              mfm->state=MFM_SYNC;
             }
             break;
 
           default:
             break;
         }
-        mfm_bits=0;
+        mfm->bits=0;
         break;
 
       case MFM_ADDR:
-        if (mfm_bitlen<mfm_blocksize)
+        if (mfm->bitlen<mfm->blocksize)
         {
-          mfm_bitstream[mfm_bitlen++]=data;
-          mfm_bits=0;
+          mfm->bitstream[mfm->bitlen++]=data;
+          mfm->bits=0;
         }
         else
         {
-          mfm_idblockcrc=calc_crc(&mfm_bitstream[0], mfm_bitlen-2);
-          mfm_bitstreamcrc=(((unsigned int)mfm_bitstream[mfm_bitlen-2]<<8)|mfm_bitstream[mfm_bitlen-1]);
-          dataCRC=(mfm_idblockcrc==mfm_bitstreamcrc)?GOODDATA:BADDATA;
+          mfm->idblockcrc=calc_crc(&mfm->bitstream[0], mfm->bitlen-2);
+          mfm->bitstreamcrc=(((unsigned int)mfm->bitstream[mfm->bitlen-2]<<8)|mfm->bitstream[mfm->bitlen-1]);
+          dataCRC=(mfm->idblockcrc==mfm->bitstreamcrc)?GOODDATA:BADDATA;
 
-          if (mfm_debug)
+          if (ctx->debug)
           {
-            fprintf(stderr, "Track %.02d ", mfm_bitstream[4]);
-            fprintf(stderr, "Head %d ", mfm_bitstream[5]);
-            fprintf(stderr, "Sector %.02d ", mfm_bitstream[6]);
-            fprintf(stderr, "Data size %d ", mfm_bitstream[7]);
-            fprintf(stderr, "CRC %.2x%.2x ", mfm_bitstream[mfm_bitlen-2], mfm_bitstream[mfm_bitlen-1]);
+            fprintf(stderr, "Track %.02d ", mfm->bitstream[4]);
+            fprintf(stderr, "Head %d ", mfm->bitstream[5]);
+            fprintf(stderr, "Sector %.02d ", mfm->bitstream[6]);
+            fprintf(stderr, "Data size %d ", mfm->bitstream[7]);
+            fprintf(stderr, "CRC %.2x%.2x ", mfm->bitstream[mfm->bitlen-2], mfm->bitstream[mfm->bitlen-1]);
 
             if (dataCRC==GOODDATA)
               fprintf(stderr, "OK\n");
             else
-              fprintf(stderr, "BAD (%.4x)\n", mfm_idblockcrc);
+              fprintf(stderr, "BAD (%.4x)\n", mfm->idblockcrc);
           }
 
           if (dataCRC==GOODDATA)
           {
             // Record IDAM values
-            mfm_idamtrack=mfm_bitstream[4];
-            mfm_idamhead=mfm_bitstream[5];
-            mfm_idamsector=mfm_bitstream[6];
-            mfm_idamlength=mfm_bitstream[7];
+            mfm->idamtrack=mfm->bitstream[4];
+            mfm->idamhead=mfm->bitstream[5];
+            mfm->idamsector=mfm->bitstream[6];
+            mfm->idamlength=mfm->bitstream[7];
 
             // Record last known good IDAM values for this track
-            mfm_lasttrack=mfm_idamtrack;
-            mfm_lasthead=mfm_idamhead;
-            mfm_lastsector=mfm_idamsector;
-            mfm_lastlength=mfm_idamlength;
+            mfm->lasttrack=mfm->idamtrack;
+            mfm->lasthead=mfm->idamhead;
+            mfm->lastsector=mfm->idamsector;
+            mfm->lastlength=mfm->idamlength;
 
             // Sanitise data block length
-            switch(mfm_idamlength)
+            switch(mfm->idamlength)
             {
               case 0x00: // 128
               case 0x01: // 256
@@ -225,112 +203,125 @@ void mfm_addbit(const unsigned char bit, const unsigned long datapos)
               case 0x05: // 4096
               case 0x06: // 8192
               case 0x07: // 16384
-                mfm_blocksize=3+1+(128<<mfm_idamlength)+2;
+                mfm->blocksize=3+1+(128<<mfm->idamlength)+2;
                 break;
 
               default:
-                if (mfm_debug)
-                  fprintf(stderr, "Invalid record length %.2x\n", mfm_idamlength);
+                if (ctx->debug)
+                  fprintf(stderr, "Invalid record length %.2x\n", mfm->idamlength);
 
-                mfm_state=MFM_SYNC;
+                mfm->state=MFM_SYNC;
                 break;
             }
+
+            // Already have this sector, so don't read its data block again
+            if ((ctx->hassector!=NULL) && (ctx->hassector(ctx, mfm->idamtrack, mfm->idamhead, mfm->idamsector, mfm->idamlength, mfm->idblockcrc)))
+            {
+              if (ctx->debug)
+                fprintf(stderr, "Already have this sector, skipping data block\n");
+
+              mfm->idamtrack=-1;
+              mfm->idamhead=-1;
+              mfm->idamsector=-1;
+              mfm->idamlength=-1;
+            }
           }
 
-          mfm_state=MFM_SYNC;
+          mfm->state=MFM_SYNC;
         }
         break;
 
       case MFM_DATA:
-        if (mfm_bitlen<mfm_blocksize)
+        if (mfm->bitlen<mfm->blocksize)
         {
-          mfm_bitstream[mfm_bitlen++]=data;
-          mfm_bits=0;
+          mfm->bitstream[mfm->bitlen++]=data;
+          mfm->bits=0;
         }
         else
         {
-          mfm_datablockcrc=calc_crc(&mfm_bitstream[0], mfm_bitlen-2);
-          mfm_bitstreamcrc=(((unsigned int)mfm_bitstream[mfm_bitlen-2]<<8)|mfm_bitstream[mfm_bitlen-1]);
-          dataCRC=(mfm_datablockcrc==mfm_bitstreamcrc)?GOODDATA:BADDATA;
+          mfm->datablockcrc=calc_crc(&mfm->bitstream[0], mfm->bitlen-2);
+          mfm->bitstreamcrc=(((unsigned int)mfm->bitstream[mfm->bitlen-2]<<8)|mfm->bitstream[mfm->bitlen-1]);
+          dataCRC=(mfm->datablockcrc==mfm->bitstreamcrc)?GOODDATA:BADDATA;
 
-          if (mfm_debug)
+          if (ctx->debug)
           {
-            fprintf(stderr, "DATA block %.2x ", mfm_blocktype);
-            fprintf(stderr, "CRC %.2x%.2x ", mfm_bitstream[mfm_bitlen-2], mfm_bitstream[mfm_bitlen-2]);
+            fprintf(stderr, "DATA block %.2x ", mfm->blocktype);
+            fprintf(stderr, "CRC %.2x%.2x ", mfm->bitstream[mfm->bitlen-2], mfm->bitstream[mfm->bitlen-2]);
 
             if (dataCRC==GOODDATA)
               fprintf(stderr, "OK\n");
             else
-              fprintf(stderr, "BAD (%.4x)\n", mfm_datablockcrc);
+              fprintf(stderr, "BAD (%.4x)\n", mfm->datablockcrc);
           }
 
           if (dataCRC==GOODDATA)
           {
-            if (diskstore_addsector(MODMFM, hw_currenttrack, hw_currenthead, mfm_idamtrack, mfm_idamhead, mfm_idamsector, mfm_idamlength, mfm_idpos, mfm_idblockcrc, mfm_blockpos, mfm_blocktype, mfm_blocksize-3-1-2, &mfm_bitstream[4], mfm_datablockcrc)==1)
+            if (ctx->addsector(ctx, MODMFM, mfm->idamtrack, mfm->idamhead, mfm->idamsector, mfm->idamlength, mfm->idpos, mfm->idblockcrc, mfm->blockpos, datapos, mfm->blocktype, mfm->blocksize-3-1-2, &mfm->bitstream[4], mfm->datablockcrc)==1)
             {
-              if (mfm_debug)
-                fprintf(stderr, "** MFM new sector T%d H%d - C%d H%d R%d N%d - IDCRC %.4x DATACRC %.4x **\n", hw_currenttrack, hw_currenthead, mfm_idamtrack, mfm_idamhead, mfm_idamsector, mfm_idamlength, mfm_idblockcrc, mfm_datablockcrc);
+              if (ctx->debug)
+                fprintf(stderr, "** MFM new sector T%d H%d - C%d H%d R%d N%d - IDCRC %.4x DATACRC %.4x **\n", ctx->track, ctx->head, mfm->idamtrack, mfm->idamhead, mfm->idamsector, mfm->idamlength, mfm->idblockcrc, mfm->datablockcrc);
             }
           }
 
-          mfm_state=MFM_SYNC;
+          mfm->state=MFM_SYNC;
         }
         break;
 
       default:
         // Unknown state, put it back to SYNC
-        mfm_p1=0;
-        mfm_p2=0;
-        mfm_p3=0;
-        mfm_bits=0;
+        mfm->p1=0;
+        mfm->p2=0;
+        mfm->p3=0;
+        mfm->bits=0;
 
-        mfm_state=MFM_SYNC;
+        mfm->state=MFM_SYNC;
         break;
     }
   }
 }
 
-void mfm_addsample(const unsigned long samples, const unsigned long datapos)
+void mfm_addsample(Mod_Context *ctx, const unsigned long samples, const unsigned long datapos)
 {
+  MFM_Context *mfm=&ctx->mfm;
+
   // Does number of samples fit within "01" bucket ..
-  if (samples<=mfm_bucket01)
+  if (samples<=mfm->bucket01)
   {
-    mfm_addbit(0, datapos);
-    mfm_addbit(1, datapos);
+    mfm_addbit(ctx, 0, datapos);
+    mfm_addbit(ctx, 1, datapos);
   }
   else // .. does number of samples fit within "001" bucket ..
-  if (samples<=mfm_bucket001)
+  if (samples<=mfm->bucket001)
   {
-    mfm_addbit(0, datapos);
-    mfm_addbit(0, datapos);
-    mfm_addbit(1, datapos);
+    mfm_addbit(ctx, 0, datapos);
+    mfm_addbit(ctx, 0, datapos);
+    mfm_addbit(ctx, 1, datapos);
   }
   else // .. does number of samples fit within "0001" bucket ..
-  if (samples<=mfm_bucket0001)
+  if (samples<=mfm->bucket0001)
   {
-    mfm_addbit(0, datapos);
-    mfm_addbit(0, datapos);
-    mfm_addbit(0, datapos);
-    mfm_addbit(1, datapos);
+    mfm_addbit(ctx, 0, datapos);
+    mfm_addbit(ctx, 0, datapos);
+    mfm_addbit(ctx, 0, datapos);
+    mfm_addbit(ctx, 1, datapos);
   }
   else
   {
     // TODO This shouldn't happen in MFM encoding
-    mfm_addbit(0, datapos);
-    mfm_addbit(0, datapos);
-    mfm_addbit(0, datapos);
-    mfm_addbit(0, datapos);
-    mfm_addbit(1, datapos);
+    mfm_addbit(ctx, 0, datapos);
+    mfm_addbit(ctx, 0, datapos);
+    mfm_addbit(ctx, 0, datapos);
+    mfm_addbit(ctx, 0, datapos);
+    mfm_addbit(ctx, 1, datapos);
   }
 }
 
-void mfm_init(const int debug, const char density)
+void mfm_init(Mod_Context *ctx, const char density)
 {
+  MFM_Context *mfm=&ctx->mfm;
   char bitcell=MFM_BITCELLDD;
   float diff;
 
-  mfm_debug=debug;
-
   if ((density&MOD_DENSITYMFMED)!=0)
     bitcell=MFM_BITCELLED;
 
@@ -338,50 +329,50 @@ void mfm_init(const int debug, const char density)
     bitcell=MFM_BITCELLHD;
 
   // Determine number of samples between "1" pulses (default window)
-  mfm_defaultwindow=((float)hw_samplerate/(float)USINSECOND)*(float)bitcell;
+  mfm->defaultwindow=((float)ctx->samplerate/(float)USINSECOND)*(float)bitcell;
 
   // From default window, determine ideal sample times for assigning bits "01", "001" or "0001"
-  mfm_bucket01=mfm_defaultwindow;
-  mfm_bucket001=(mfm_defaultwindow/2)*3;
-  mfm_bucket0001=(mfm_defaultwindow/2)*4;
+  mfm->bucket01=mfm->defaultwindow;
+  mfm->bucket001=(mfm->defaultwindow/2)*3;
+  mfm->bucket0001=(mfm->defaultwindow/2)*4;
 
   // Increase bucket sizes to halfway between peaks
-  diff=mfm_bucket001-mfm_bucket01;
-  mfm_bucket01+=(diff/2);
-  mfm_bucket001+=(diff/2);
-  mfm_bucket0001+=(diff/2);
+  diff=mfm->bucket001-mfm->bucket01;
+  mfm->bucket01+=(diff/2);
+  mfm->bucket001+=(diff/2);
+  mfm->bucket0001+=(diff/2);
 
   // Set up MFM parser
-  mfm_state=MFM_SYNC;
-  mfm_datacells=0;
-  mfm_bits=0;
+  mfm->state=MFM_SYNC;
+  mfm->datacells=0;
+  mfm->bits=0;
 
-  mfm_idpos=0;
-  mfm_blockpos=0;
+  mfm->idpos=0;
+  mfm->blockpos=0;
 
-  mfm_blocktype=MFM_BLOCKNULL;
-  mfm_blocksize=0;
+  mfm->blocktype=MFM_BLOCKNULL;
+  mfm->blocksize=0;
 
-  mfm_idblockcrc=0;
-  mfm_datablockcrc=0;
-  mfm_bitstreamcrc=0;
+  mfm->idblockcrc=0;
+  mfm->datablockcrc=0;
+  mfm->bitstreamcrc=0;
 
-  mfm_bitlen=0;
+  mfm->bitlen=0;
 
   // Initialise previous data cache
-  mfm_p1=0;
-  mfm_p2=0;
-  mfm_p3=0;
+  mfm->p1=0;
+  mfm->p2=0;
+  mfm->p3=0;
 
   // Initialise last found sector IDAM to invalid
-  mfm_idamtrack=-1;
-  mfm_idamhead=-1;
-  mfm_idamsector=-1;
-  mfm_idamlength=-1;
+  mfm->idamtrack=-1;
+  mfm->idamhead=-1;
+  mfm->idamsector=-1;
+  mfm->idamlength=-1;
 
   // Initialise last known good sector IDAM to invalid
-  mfm_lasttrack=-1;
-  mfm_lasthead=-1;
-  mfm_lastsector=-1;
-  mfm_lastlength=-1;
+  mfm->lasttrack=-1;
+  mfm->lasthead=-1;
+  mfm->lastsector=-1;
+  mfm->lastlength=-1;
 }
@@ -41,11 +41,35 @@
 #define MFM_ADDR 3
 #define MFM_DATA 4
 
-extern int mfm_idamtrack, mfm_idamhead, mfm_idamsector, mfm_idamlength; 
-extern int mfm_lasttrack, mfm_lasthead, mfm_lastsector, mfm_lastlength;
+struct ModContext;
 
-extern void mfm_addsample(const unsigned long samples, const unsigned long datapos);
+// MFM parser state, one per track being decoded
+typedef struct MFMContext
+{
+  int state; // state machine
+  unsigned int datacells; // 16 bit sliding buffer
+  int bits; // Number of used bits within sliding buffer
+  unsigned int p1, p2, p3; // bit history
 
-extern void mfm_init(const int debug, const char density);
+  // Most recent address mark, also set by the Amiga MFM parser
+  unsigned long idpos, blockpos;
+  int idamtrack, idamhead, idamsector, idamlength; // IDAM values
+  int lasttrack, lasthead, lastsector, lastlength; // last known good IDAM values
+  unsigned char blocktype;
+  unsigned int blocksize;
+  unsigned int idblockcrc, datablockcrc, bitstreamcrc;
+
+  // Output block data buffer, for a single sector
+  unsigned char bitstream[MFM_BLOCKSIZE];
+  unsigned int bitlen;
+
+  // MFM timings
+  float defaultwindow;
+  float bucket01, bucket001, bucket0001;
+} MFM_Context;
+
+extern void mfm_addsample(struct ModContext *ctx, const unsigned long samples, const unsigned long datapos);
+
+extern void mfm_init(struct ModContext *ctx, const char density);
 
 #endif
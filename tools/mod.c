@@ -1,4 +1,17 @@
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Vector level change detection, where the compiler supports it
+#if !defined(NOSIMD) && defined(__GNUC__) && (__BYTE_ORDER__==__ORDER_LITTLE_ENDIAN__)
+#if defined(__x86_64__) || defined(__i386__)
+#define MOD_SIMDX86
+#include <immintrin.h>
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#define MOD_SIMDNEON
+#include <arm_neon.h>
+#endif
+#endif
 
 #include "hardware.h"
 #include "fm.h"
@@ -6,16 +19,37 @@
 #include "amigamfm.h"
 #include "applegcr.h"
 #include "gcr.h"
+#include "diskstore.h"
 #include "mod.h"
 
 int mod_debug=0;
-unsigned long mod_datapos;
 unsigned long mod_samplesize;
 
-unsigned long mod_hist[MOD_HISTOGRAMSIZE];
-int mod_peak[MOD_PEAKSIZE];
-int mod_peaks;
 char mod_density=MOD_DENSITYAUTO;
+int mod_decoders=MOD_DECODEALL;
+
+// Skip the data blocks of sectors already held, only when the output doesn't keep every copy of a sector
+int mod_skipheld=0;
+
+Mod_Flux mod_flux={NULL, 0, 0, 0, 0, 0, 0, {NULL, 0, 0, 0, 0, 0}};
+
+// Context for decoding one track at a time
+Mod_Context mod_context;
+
+// Edge lookup tables, indexed by a byte of level change flags
+unsigned char mod_edgecount[256]; // Number of level changes in byte
+unsigned char mod_edgedelta[256][MOD_MAXEDGES]; // Samples up to and including each level change
+unsigned char mod_edgetail[256]; // Samples after last level change to end of byte
+
+// Edge lookup tables for SPI samples, where each byte follows a gap sample which matches its first
+unsigned char mod_spiedgedelta[256][MOD_MAXEDGES]; // Samples up to and including each level change, from the gap sample
+unsigned char mod_spiedgetail[256]; // Samples after last level change to end of byte
+
+// Samples in each byte in reverse order
+unsigned char mod_reversebyte[256];
+
+// Vector kernel for finding level changes in a block of samples, NULL when not available
+int (*mod_fluxkernel)(const unsigned char *sampledata, unsigned char *changes)=NULL;
 
 float mod_samplestoms(const long samples)
 {
@@ -27,93 +61,87 @@ long mod_mstosamples(const float ms)
   return (ms/((float)1/(((float)hw_samplerate)/(float)USINSECOND)));
 }
 
-void mod_buildhistogram(const unsigned char *sampledata, const unsigned long samplesize)
+void mod_buildhistogram(Mod_Context *ctx)
 {
+  const Mod_Flux *flux;
   int j;
-  char level,bi=0;
-  unsigned char c;
-  int count;
-  unsigned long datapos;
+  unsigned char level;
+  unsigned long i;
+  unsigned long count;
 
-  if (mod_debug)
-    fprintf(stderr, "Creating histogram for track %d, head %d data sampled at %lu with %.2f rpm\n", hw_currenttrack, hw_currenthead, hw_samplerate, hw_rpm);
+  if (ctx->debug)
+    fprintf(stderr, "Creating histogram for track %d, head %d data sampled at %lu with %.2f rpm\n", ctx->track, ctx->head, ctx->samplerate, hw_rpm);
 
   // Clear histogram
-  for (j=0; j<MOD_HISTOGRAMSIZE; j++) mod_hist[j]=0;
+  for (j=0; j<MOD_HISTOGRAMSIZE; j++) ctx->hist[j]=0;
 
   // Build histogram
-  level=(sampledata[0]&0x80)>>7;
-  bi=level;
+  flux=&ctx->flux;
+  level=flux->level;
   count=0;
 
-  for (datapos=0; datapos<samplesize; datapos++)
+  for (i=0; i<flux->len; i++)
   {
-    c=sampledata[datapos];
-
-    for (j=0; j<BITSPERBYTE; j++)
+    // Look for extended runs
+    if (flux->runs[i]==0)
     {
-      bi=((c&0x80)>>7);
+      count+=MOD_FLUXEXTEND;
+      continue;
+    }
 
-      count++;
+    count+=flux->runs[i];
+    level=1-level;
 
-      if (bi!=level)
-      {
-        level=1-level;
-
-        // Look for rising edge
-        if (level==1)
-        {
-          if (count<MOD_HISTOGRAMSIZE)
-            mod_hist[count]++;
-
-          count=0;
-        }
-      }
+    // Look for rising edge
+    if (level==1)
+    {
+      if (count<MOD_HISTOGRAMSIZE)
+        ctx->hist[count]++;
 
-      c=c<<1;
+      count=0;
     }
   }
 }
 
-int mod_findpeaks(const unsigned char *sampledata, const unsigned long samplesize)
+int mod_findpeaks(Mod_Context *ctx)
 {
   int j;
   long localmaxima;
   unsigned long threshold;
   int inpeak;
 
-  mod_buildhistogram(sampledata, samplesize);
+  mod_buildhistogram(ctx);
 
   // Find largest histogram value
   localmaxima=0;
   for (j=0; j<MOD_HISTOGRAMSIZE; j++)
-    if (mod_hist[j]>mod_hist[localmaxima])
+    if (ctx->hist[j]>ctx->hist[localmaxima])
       localmaxima=j;
 
-  if (mod_debug)
-    fprintf(stderr, "Maximum peak on track %d, head %d at %ld samples, %.3fms\n", hw_currenttrack, hw_currenthead, localmaxima, mod_samplestoms(localmaxima));
+  if (ctx->debug)
+    fprintf(stderr, "Maximum peak on track %d, head %d at %ld samples, %.3fms\n", ctx->track, ctx->head, localmaxima, mod_samplestoms(localmaxima));
 
   // Set noise threshold at 5% of maximum
-  threshold=mod_hist[localmaxima]/20;
+  threshold=ctx->hist[localmaxima]/20;
 
   // Decimate histogram to remove values below threshold
   for (j=0; j<MOD_HISTOGRAMSIZE; j++)
-    if (mod_hist[j]<=threshold)
-      mod_hist[j]=0;
+    if (ctx->hist[j]<=threshold)
+      ctx->hist[j]=0;
 
   // Find peaks
-  inpeak=0; mod_peaks=0; localmaxima=0;
+  inpeak=0; ctx->peaks=0; localmaxima=0;
   for (j=0; j<MOD_HISTOGRAMSIZE; j++)
   {
-    if (mod_hist[j]!=0)
+    if (ctx->hist[j]!=0)
     {
-      if (mod_hist[j]>mod_hist[localmaxima])
+      if (ctx->hist[j]>ctx->hist[localmaxima])
         localmaxima=j;
 
       // Mark the start of a new peak
       if (inpeak==0)
       {
-        mod_peaks++;
+        ctx->peaks++;
         inpeak=1;
       }
     }
@@ -121,11 +149,11 @@ int mod_findpeaks(const unsigned char *sampledata, const unsigned long samplesiz
     {
       if (inpeak==1)
       {
-        if (mod_debug)
+        if (ctx->debug)
           fprintf(stderr, "  Peak at %ld %.3fms\n", localmaxima, mod_samplestoms(localmaxima));
 
-        if (mod_peaks<MOD_PEAKSIZE)
-          mod_peak[mod_peaks-1]=localmaxima;
+        if (ctx->peaks<MOD_PEAKSIZE)
+          ctx->peak[ctx->peaks-1]=localmaxima;
 
         localmaxima=0;
       }
@@ -134,20 +162,20 @@ int mod_findpeaks(const unsigned char *sampledata, const unsigned long samplesiz
     }
   }
 
-  if (mod_debug)
-    fprintf(stderr, "Found %d peaks\n", mod_peaks);
+  if (ctx->debug)
+    fprintf(stderr, "Found %d peaks\n", ctx->peaks);
 
-  return mod_peaks;
+  return ctx->peaks;
 }
 
-int mod_haspeak(const float ms)
+int mod_haspeak(const Mod_Context *ctx, const float ms)
 {
   int i;
   float peakms;
 
-  for (i=0; i<mod_peaks; i++)
+  for (i=0; (i<ctx->peaks) && (i<MOD_PEAKSIZE); i++)
   {
-    peakms=mod_samplestoms(mod_peak[i]);
+    peakms=mod_samplestoms(ctx->peak[i]);
 
     // Look within 10% of nominal
     if ((ms>=(peakms*0.90)) && (ms<=(peakms*1.1)))
@@ -157,49 +185,51 @@ int mod_haspeak(const float ms)
   return 0;
 }
 
-void mod_checkdensity()
+void mod_checkdensity(Mod_Context *ctx)
 {
+  ctx->density=MOD_DENSITYAUTO;
+
   // APPLE GCR
   // 1=4ms, 01=8ms, 001=12ms
-  if ((mod_haspeak(4)+mod_haspeak(8)+mod_haspeak(12))==3)
+  if ((mod_haspeak(ctx, 4)+mod_haspeak(ctx, 8)+mod_haspeak(ctx, 12))==3)
   {
-    mod_density|=MOD_DENSITYAPPLEGCR;
+    ctx->density|=MOD_DENSITYAPPLEGCR;
 
     return;
   }
 
   // MFM ED
   // 01=1ms, 001=1.5ms, 0001=2ms
-  if ((mod_haspeak(1)+mod_haspeak(1.5)+mod_haspeak(2))==3)
+  if ((mod_haspeak(ctx, 1)+mod_haspeak(ctx, 1.5)+mod_haspeak(ctx, 2))==3)
   {
-    mod_density|=MOD_DENSITYMFMED;
+    ctx->density|=MOD_DENSITYMFMED;
 
     return;
   }
 
   // MFM HD
   // 01=2ms, 001=3ms, 0001=4ms
-  if ((mod_haspeak(2)+mod_haspeak(3)+mod_haspeak(4))==3)
+  if ((mod_haspeak(ctx, 2)+mod_haspeak(ctx, 3)+mod_haspeak(ctx, 4))==3)
   {
-    mod_density|=MOD_DENSITYMFMHD;
+    ctx->density|=MOD_DENSITYMFMHD;
 
     return;
   }
 
   // MFM DD
   // 01=4ms, 001=6ms, 0001=8ms
-  if ((mod_haspeak(4)+mod_haspeak(6)+mod_haspeak(8))==3)
+  if ((mod_haspeak(ctx, 4)+mod_haspeak(ctx, 6)+mod_haspeak(ctx, 8))==3)
   {
-    mod_density|=MOD_DENSITYMFMDD;
+    ctx->density|=MOD_DENSITYMFMDD;
 
     return;
   }
 
   // FM SD
   // 1=4ms, 01=8ms
-  if ((mod_haspeak(4)+mod_haspeak(8))==2)
+  if ((mod_haspeak(ctx, 4)+mod_haspeak(ctx, 8))==2)
   {
-    mod_density|=MOD_DENSITYFMSD;
+    ctx->density|=MOD_DENSITYFMSD;
 
     return;
   }
@@ -237,65 +267,717 @@ unsigned char mod_getdata(const unsigned int datacells)
   return data;
 }
 
-void mod_process(const unsigned char *sampledata, const unsigned long samplesize, const int attempt)
+// Append a run of samples, ending in a level change, to the flux runs
+int mod_addfluxrun(Mod_Flux *flux, unsigned long samples)
 {
-  unsigned long count;
-  unsigned char c, j;
-  char level,bi=0;
+  // Make sure there is space for the run and any extensions it needs
+  while ((flux->len+(samples/MOD_FLUXEXTEND)+1)>flux->size)
+  {
+    uint16_t *newruns;
+    unsigned long newsize;
 
-  mod_samplesize=samplesize;
+    newsize=(flux->size==0)?MOD_FLUXBLOCK:(flux->size*2);
+    newruns=realloc(flux->runs, newsize*sizeof(uint16_t));
 
-  mod_findpeaks(sampledata, samplesize);
-  mod_checkdensity();
+    if (newruns==NULL)
+      return 0;
 
-  fm_init(mod_debug, mod_density);
-  amigamfm_init(mod_debug, mod_density);
-  mfm_init(mod_debug, mod_density);
-  gcr_init(mod_debug, mod_density);
-  applegcr_init(mod_debug, mod_density);
+    flux->runs=newruns;
+    flux->size=newsize;
+  }
 
-  // Set up the sampler
-  level=(sampledata[0]&0x80)>>7;
-  bi=level;
-  count=0;
+  // Split runs which are too long to store
+  while (samples>MOD_FLUXEXTEND)
+  {
+    flux->runs[flux->len++]=0;
+    samples-=MOD_FLUXEXTEND;
+  }
+
+  flux->runs[flux->len++]=samples;
+
+  return 1;
+}
+
+#ifdef MOD_SIMDX86
+// Find level changes in a block of samples using SSE2, needs the byte before the block
+__attribute__((target("sse2")))
+int mod_findchanges_sse2(const unsigned char *sampledata, unsigned char *changes)
+{
+  __m128i samples, previous, shifted, found;
+  __m128i anyfound=_mm_setzero_si128();
+  int i;
+
+  for (i=0; i<MOD_SIMDBLOCK; i+=16)
+  {
+    samples=_mm_loadu_si128((const __m128i *)&sampledata[i]);
+    previous=_mm_loadu_si128((const __m128i *)&sampledata[i-1]);
+
+    // Line up each sample with the one before it, there are no 8 bit shifts so mask off the neighbouring byte
+    shifted=_mm_or_si128(_mm_and_si128(_mm_srli_epi16(samples, 1), _mm_set1_epi8(0x7f)), _mm_and_si128(_mm_slli_epi16(previous, 7), _mm_set1_epi8((char)0x80)));
 
-  // Process each byte of the raw flux data
-  for (mod_datapos=0; mod_datapos<samplesize; mod_datapos++)
+    found=_mm_xor_si128(samples, shifted);
+    _mm_storeu_si128((__m128i *)&changes[i], found);
+    anyfound=_mm_or_si128(anyfound, found);
+  }
+
+  return (_mm_movemask_epi8(_mm_cmpeq_epi8(anyfound, _mm_setzero_si128()))!=0xffff);
+}
+
+// Find level changes in a block of samples using AVX2, needs the byte before the block
+__attribute__((target("avx2")))
+int mod_findchanges_avx2(const unsigned char *sampledata, unsigned char *changes)
+{
+  __m256i samples, previous, shifted, found;
+  __m256i anyfound=_mm256_setzero_si256();
+  int i;
+
+  for (i=0; i<MOD_SIMDBLOCK; i+=32)
+  {
+    samples=_mm256_loadu_si256((const __m256i *)&sampledata[i]);
+    previous=_mm256_loadu_si256((const __m256i *)&sampledata[i-1]);
+
+    shifted=_mm256_or_si256(_mm256_and_si256(_mm256_srli_epi16(samples, 1), _mm256_set1_epi8(0x7f)), _mm256_and_si256(_mm256_slli_epi16(previous, 7), _mm256_set1_epi8((char)0x80)));
+
+    found=_mm256_xor_si256(samples, shifted);
+    _mm256_storeu_si256((__m256i *)&changes[i], found);
+    anyfound=_mm256_or_si256(anyfound, found);
+  }
+
+  return !_mm256_testz_si256(anyfound, anyfound);
+}
+#endif
+
+#ifdef MOD_SIMDNEON
+// Find level changes in a block of samples using NEON, needs the byte before the block
+int mod_findchanges_neon(const unsigned char *sampledata, unsigned char *changes)
+{
+  uint8x16_t samples, previous, found;
+  uint8x16_t anyfound=vdupq_n_u8(0);
+  uint64x2_t anywide;
+  int i;
+
+  for (i=0; i<MOD_SIMDBLOCK; i+=16)
+  {
+    samples=vld1q_u8(&sampledata[i]);
+    previous=vld1q_u8(&sampledata[i-1]);
+
+    found=veorq_u8(samples, vorrq_u8(vshrq_n_u8(samples, 1), vshlq_n_u8(previous, 7)));
+    vst1q_u8(&changes[i], found);
+    anyfound=vorrq_u8(anyfound, found);
+  }
+
+  anywide=vreinterpretq_u64_u8(anyfound);
+
+  return ((vgetq_lane_u64(anywide, 0)|vgetq_lane_u64(anywide, 1))!=0);
+}
+#endif
+
+// Extract the level changes from raw sample data into flux runs
+int mod_buildflux(Mod_Flux *flux, const unsigned char *sampledata, const unsigned long samplesize)
+{
+  flux->len=0;
+  flux->samples=0;
+  flux->level=0;
+  flux->tail=0;
+  flux->format=0;
+
+  return mod_extendflux(flux, sampledata, samplesize);
+}
+
+// Set up the run lengths which flux is to be extracted from, for a buffer of samplesize bytes
+void mod_setrle(Mod_Flux *flux, const unsigned char *rledata, const unsigned long rlelen, const unsigned long samplesize)
+{
+  unsigned long i, samples;
+
+  samples=0;
+  for (i=0; i<rlelen; i++)
+    samples+=rledata[i];
+
+  // Run lengths only fill whole bytes of samples, and are cut short to fit the buffer
+  samples-=(samples%BITSPERBYTE);
+  if (samples>(samplesize*BITSPERBYTE))
+    samples=samplesize*BITSPERBYTE;
+
+  flux->rle.data=rledata;
+  flux->rle.len=rlelen;
+  flux->rle.samples=samples;
+  flux->rle.pos=0;
+  flux->rle.left=0;
+  flux->rle.level=0;
+}
+
+// Extract flux from run lengths, as if they had been expanded into a buffer of samplesize bytes
+int mod_buildrleflux(Mod_Flux *flux, const unsigned char *rledata, const unsigned long rlelen, const unsigned long samplesize)
+{
+  flux->len=0;
+  flux->samples=0;
+  flux->level=0;
+  flux->tail=0;
+  flux->format=MOD_SAMPLESRLE;
+
+  mod_setrle(flux, rledata, rlelen, samplesize);
+
+  return mod_extendflux(flux, rledata, samplesize);
+}
+
+// Extract level changes from run lengths, for the samples which have arrived since the flux was last extended
+//   each run length is used directly, so the samples never need expanding into a buffer
+int mod_extendrleflux(Mod_Flux *flux, const unsigned long samplesize)
+{
+  Mod_RLE *rle;
+  unsigned long pos, limit, run, n;
+  unsigned char level;
+
+  rle=&flux->rle;
+
+  pos=flux->samples;
+  limit=samplesize*BITSPERBYTE;
+
+  if (pos>=limit) return 1;
+
+  // Carry on from the last sample already extracted
+  level=rle->level;
+  run=flux->tail;
+
+  while (pos<limit)
+  {
+    // Move on to the next run length once this one is used up
+    if (rle->left==0)
+    {
+      if ((rle->pos<rle->len) && (pos<rle->samples))
+      {
+        // Levels alternate, so are given by the position of the run length
+        rle->level=(rle->pos&0x01);
+        rle->left=rle->data[rle->pos++];
+
+        if (rle->left>(rle->samples-pos))
+          rle->left=rle->samples-pos;
+
+        continue;
+      }
+
+      // Rest of the buffer is left at level 0
+      rle->level=0;
+      rle->left=limit-pos;
+    }
+
+    n=rle->left;
+    if (n>(limit-pos))
+      n=limit-pos;
+
+    if (pos==0)
+    {
+      // Set up the sampler from the first sample
+      flux->level=rle->level;
+      run=n;
+    }
+    else
+    if (rle->level!=level)
+    {
+      // Level changes at the first sample of this run
+      if (!mod_addfluxrun(flux, run+1))
+        return 0;
+
+      run=n-1;
+    }
+    else
+      run+=n;
+
+    level=rle->level;
+    rle->left-=n;
+    pos+=n;
+  }
+
+  flux->samples=limit;
+  flux->tail=run;
+
+  return 1;
+}
+
+// Extract level changes from SPI samples which have arrived since the flux was last extended
+//   the gap sample before each byte is counted as it is found, rather than first fixing the samples
+int mod_extendspiflux(Mod_Flux *flux, const unsigned char *sampledata, const unsigned long samplesize)
+{
+  unsigned long datapos, run;
+  unsigned char c, j, changes;
+  unsigned char level;
+
+  datapos=flux->samples/(BITSPERBYTE+1);
+
+  if (datapos>=samplesize) return 1;
+
+  // Set up the sampler, carrying on from the last sample already extracted
+  if (datapos==0)
+  {
+    level=(sampledata[0]&0x80)>>7;
+    flux->level=level;
+  }
+  else
+    level=sampledata[datapos-1]&0x01;
+
+  run=flux->tail;
+
+  // Process the raw flux data
+  while (datapos<samplesize)
   {
     // Extract byte from buffer
-    c=sampledata[mod_datapos];
+    c=sampledata[datapos++];
 
-    // Process each bit of the extracted byte
-    for (j=0; j<BITSPERBYTE; j++)
+    // Find level changes, using the last sample of the previous byte, the gap sample can only differ from that
+    changes=c^((c>>1)|(level<<7));
+    level=c&0x01;
+
+    for (j=0; j<mod_edgecount[changes]; j++)
     {
-      // Determine next level
-      bi=((c&0x80)>>7);
+      run+=mod_spiedgedelta[changes][j];
 
-      // Increment samples counter
-      count++;
+      if (!mod_addfluxrun(flux, run))
+        return 0;
 
-      // Look for level changes
-      if (bi!=level)
-      {
-        // Flip level cache
-        level=1-level;
+      run=0;
+    }
+
+    // Add samples following the last level change
+    run+=mod_spiedgetail[changes];
+  }
+
+  flux->samples=samplesize*(BITSPERBYTE+1);
+  flux->tail=run;
+
+  return 1;
+}
+
+// Extract level changes from samples read backwards from the end of the buffer, last sample first
+//   the start of the reversed samples is only known once they have all arrived, so they are extracted in one go
+int mod_extendreverseflux(Mod_Flux *flux, const unsigned char *sampledata, const unsigned long samplesize)
+{
+  unsigned long datapos, run;
+  unsigned char c, j, changes;
+  unsigned char level;
+
+  if ((flux->samples!=0) || (samplesize==0)) return 1;
+
+  // Set up the sampler from the last sample in the buffer
+  level=sampledata[samplesize-1]&0x01;
+  flux->level=level;
+
+  run=0;
+
+  // Process the raw flux data, reversing each byte so the samples are in the order they are read
+  for (datapos=samplesize; datapos>0; datapos--)
+  {
+    c=mod_reversebyte[sampledata[datapos-1]];
+
+    // Find level changes, using the last sample of the previous byte
+    changes=c^((c>>1)|(level<<7));
+    level=c&0x01;
+
+    for (j=0; j<mod_edgecount[changes]; j++)
+    {
+      run+=mod_edgedelta[changes][j];
+
+      if (!mod_addfluxrun(flux, run))
+        return 0;
+
+      run=0;
+    }
+
+    // Add samples following the last level change
+    run+=mod_edgetail[changes];
+  }
+
+  flux->samples=samplesize*BITSPERBYTE;
+  flux->tail=run;
+
+  return 1;
+}
+
+// Extract level changes from samples which have arrived since the flux was last built or extended
+int mod_extendflux(Mod_Flux *flux, const unsigned char *sampledata, const unsigned long samplesize)
+{
+  unsigned long datapos, run;
+  unsigned char c, j, changes;
+  unsigned char level;
+  unsigned char blockchanges[MOD_SIMDBLOCK];
+  uint64_t mask;
+  unsigned int k, z, used;
+
+  if ((flux->format&MOD_SAMPLESREVERSE)!=0)
+    return mod_extendreverseflux(flux, sampledata, samplesize);
+
+  if ((flux->format&MOD_SAMPLESRLE)!=0)
+    return mod_extendrleflux(flux, samplesize);
+
+  if ((flux->format&MOD_SAMPLESSPI)!=0)
+    return mod_extendspiflux(flux, sampledata, samplesize);
+
+  datapos=flux->samples/BITSPERBYTE;
+
+  if (datapos>=samplesize) return 1;
 
-        // Look for rising edge
-        if (level==1)
+  // Set up the sampler, carrying on from the last sample already extracted
+  if (datapos==0)
+  {
+    level=(sampledata[0]&0x80)>>7;
+    flux->level=level;
+  }
+  else
+    level=sampledata[datapos-1]&0x01;
+
+  run=flux->tail;
+
+  // Process the raw flux data
+  while (datapos<samplesize)
+  {
+    // Use vector kernel for whole blocks after the first byte
+    if ((mod_fluxkernel!=NULL) && (datapos>0) && ((datapos+MOD_SIMDBLOCK)<=samplesize))
+    {
+      if (mod_fluxkernel(&sampledata[datapos], blockchanges))
+      {
+        for (k=0; k<MOD_SIMDBLOCK; k+=sizeof(mask))
         {
-          fm_addsample(count, mod_datapos);
-          amigamfm_addsample(count, mod_datapos);
-          mfm_addsample(count, mod_datapos);
-          gcr_addsample(count, mod_datapos);
-          applegcr_addsample(count, mod_datapos);
-
-          // Reset samples counter 
-          count=0;
+          // Samples are MSB first, so make the earliest sample the top bit of the word
+          memcpy(&mask, &blockchanges[k], sizeof(mask));
+          mask=__builtin_bswap64(mask);
+          used=0;
+
+          while (mask!=0)
+          {
+            z=__builtin_clzll(mask);
+            run+=(z+1);
+
+            if (!mod_addfluxrun(flux, run))
+              return 0;
+
+            run=0;
+            used+=(z+1);
+
+            // Shift out this level change
+            mask=(mask<<z)<<1;
+          }
+
+          run+=((sizeof(mask)*BITSPERBYTE)-used);
         }
       }
+      else
+        run+=(MOD_SIMDBLOCK*BITSPERBYTE);
+
+      datapos+=MOD_SIMDBLOCK;
+      level=sampledata[datapos-1]&0x01;
+
+      continue;
+    }
+
+    // Extract byte from buffer
+    c=sampledata[datapos++];
+
+    // Find level changes, using the last sample of the previous byte
+    changes=c^((c>>1)|(level<<7));
+    level=c&0x01;
+
+    for (j=0; j<mod_edgecount[changes]; j++)
+    {
+      run+=mod_edgedelta[changes][j];
+
+      if (!mod_addfluxrun(flux, run))
+        return 0;
+
+      run=0;
+    }
+
+    // Add samples following the last level change
+    run+=mod_edgetail[changes];
+  }
+
+  flux->samples=samplesize*BITSPERBYTE;
+  flux->tail=run;
+
+  return 1;
+}
+
+// Free memory used by flux runs
+void mod_freeflux(Mod_Flux *flux)
+{
+  if (flux->runs!=NULL)
+  {
+    free(flux->runs);
+    flux->runs=NULL;
+  }
+
+  flux->len=0;
+  flux->size=0;
+}
+
+// Pass the interval to each rising edge in the flux onto the selected decoders
+void mod_decodeflux(Mod_Context *ctx, const int decoders)
+{
+  ctx->cursor.run=0;
+  ctx->cursor.pos=0;
+  ctx->cursor.count=0;
+  ctx->cursor.level=ctx->flux.level;
+
+  mod_decodemore(ctx, decoders);
+}
+
+// Pass rising edges in flux added since the last decode onto the selected decoders
+void mod_decodemore(Mod_Context *ctx, const int decoders)
+{
+  void (*decoder[MOD_DECODERS])(Mod_Context *ctx, const unsigned long samples, const unsigned long datapos);
+  const Mod_Flux *flux;
+  int numdecoders, d;
+  unsigned long count, pos, datapos, i;
+  unsigned char level;
+
+  // Build list of decoders to call
+  numdecoders=0;
+  if ((decoders&MOD_DECODEFM)!=0) decoder[numdecoders++]=fm_addsample;
+  if ((decoders&MOD_DECODEAMIGAMFM)!=0) decoder[numdecoders++]=amigamfm_addsample;
+  if ((decoders&MOD_DECODEMFM)!=0) decoder[numdecoders++]=mfm_addsample;
+  if ((decoders&MOD_DECODEGCR)!=0) decoder[numdecoders++]=gcr_addsample;
+  if ((decoders&MOD_DECODEAPPLEGCR)!=0) decoder[numdecoders++]=applegcr_addsample;
+
+  if (numdecoders==0) return;
+
+  // Set up the sampler where the last decode finished
+  flux=&ctx->flux;
+  level=ctx->cursor.level;
+  count=ctx->cursor.count;
+  pos=ctx->cursor.pos;
+
+  // Process each flux run
+  for (i=ctx->cursor.run; i<flux->len; i++)
+  {
+    // Look for extended runs
+    if (flux->runs[i]==0)
+    {
+      count+=MOD_FLUXEXTEND;
+      pos+=MOD_FLUXEXTEND;
+      continue;
+    }
+
+    count+=flux->runs[i];
+    pos+=flux->runs[i];
+
+    // Flip level cache
+    level=1-level;
+
+    // Look for rising edge
+    if (level==1)
+    {
+      // Position of the byte containing this edge
+      datapos=(pos-1)/BITSPERBYTE;
+
+      for (d=0; d<numdecoders; d++)
+        decoder[d](ctx, count, datapos);
+
+      // Reset samples counter
+      count=0;
+    }
+  }
+
+  ctx->cursor.run=i;
+  ctx->cursor.pos=pos;
+  ctx->cursor.count=count;
+  ctx->cursor.level=level;
+}
+
+// Pass found sectors straight to the diskstore
+int mod_storesector(Mod_Context *ctx, const unsigned char modulation, const unsigned char logical_track, const unsigned char logical_head, const unsigned char logical_sector, const unsigned char logical_size, const long id_pos, const unsigned int idcrc, const long data_pos, const long data_endpos, const unsigned int datatype, const unsigned int datasize, const unsigned char *data, const unsigned int datacrc)
+{
+  return diskstore_addsector(modulation, ctx->track, ctx->head, logical_track, logical_head, logical_sector, logical_size, id_pos, idcrc, data_pos, data_endpos, datatype, datasize, data, datacrc);
+}
+
+// Check the diskstore for sectors already found
+int mod_hassector(Mod_Context *ctx, const unsigned char logical_track, const unsigned char logical_head, const unsigned char logical_sector, const unsigned char logical_size, const unsigned int idcrc)
+{
+  return (diskstore_findidsector(ctx->track, ctx->head, logical_track, logical_head, logical_sector, logical_size, idcrc)!=NULL);
+}
+
+// Set up a context for decoding tracks, sectors found are added to the diskstore
+void mod_initcontext(Mod_Context *ctx)
+{
+  memset(ctx, 0, sizeof(Mod_Context));
+
+  ctx->debug=mod_debug;
+  ctx->samplerate=hw_samplerate;
+  ctx->density=MOD_DENSITYAUTO;
+  ctx->addsector=mod_storesector;
+  ctx->hassector=mod_skipheld?mod_hassector:NULL;
+}
+
+// Free memory used by a context
+void mod_freecontext(Mod_Context *ctx)
+{
+  mod_freeflux(&ctx->flux);
+}
+
+// Extract flux from the samples once, then find the density of this track
+int mod_analysetrack(Mod_Context *ctx, const unsigned char *sampledata, const unsigned long samplesize)
+{
+  if (!mod_buildflux(&ctx->flux, sampledata, samplesize))
+    return 0;
+
+  mod_findpeaks(ctx);
+  mod_checkdensity(ctx);
+  ctx->analysed=1;
+
+  return 1;
+}
+
+// Extract flux from run lengths once, then find the density of this track
+int mod_analyserletrack(Mod_Context *ctx, const unsigned char *rledata, const unsigned long rlelen, const unsigned long samplesize)
+{
+  if (!mod_buildrleflux(&ctx->flux, rledata, rlelen, samplesize))
+    return 0;
+
+  mod_findpeaks(ctx);
+  mod_checkdensity(ctx);
+  ctx->analysed=1;
+
+  return 1;
+}
+
+// Run the selected decoders over an analysed track
+void mod_decodetrack(Mod_Context *ctx, const char density, const int decoders)
+{
+  fm_init(ctx, density);
+  amigamfm_init(ctx, density);
+  mfm_init(ctx, density);
+  gcr_init(ctx, density);
+  applegcr_init(ctx, density);
+
+  mod_decodeflux(ctx, decoders);
+}
+
+// Start decoding a track whose samples will arrive a chunk at a time, into a buffer of samplesize
+//   format says how the samples are held in the buffer, 0 for fixed samples in the order they were sampled
+void mod_startstream(const unsigned long samplesize, const unsigned int track, const unsigned int head, const int format)
+{
+  mod_samplesize=samplesize;
+
+  mod_context.track=track;
+  mod_context.head=head;
+  mod_context.samplerate=hw_samplerate;
+
+  mod_context.flux.len=0;
+  mod_context.flux.samples=0;
+  mod_context.flux.level=0;
+  mod_context.flux.tail=0;
+  mod_context.flux.format=format;
+
+  mod_context.analysed=0;
+}
+
+// Start decoding a track held as run lengths, which will be handed out a chunk at a time as if filling a buffer of samplesize
+void mod_startrlestream(const unsigned char *rledata, const unsigned long rlelen, const unsigned long samplesize, const unsigned int track, const unsigned int head)
+{
+  mod_startstream(samplesize, track, head, MOD_SAMPLESRLE);
+
+  mod_setrle(&mod_context.flux, rledata, rlelen, samplesize);
+}
+
+// Decode samples which have arrived since the last call, samplesize is the total captured so far
+int mod_streamsamples(const unsigned char *sampledata, const unsigned long samplesize)
+{
+  if (!mod_extendflux(&mod_context.flux, sampledata, samplesize))
+  {
+    fprintf(stderr, "Unable to allocate flux buffer\n");
+    return 0;
+  }
+
+  // Carry on from where the decoders got to last time
+  if (mod_context.analysed)
+  {
+    mod_decodemore(&mod_context, mod_decoders);
+    return 1;
+  }
+
+  // Density is found from the first samples to arrive
+  mod_findpeaks(&mod_context);
+  mod_checkdensity(&mod_context);
+  mod_context.analysed=1;
+
+  // Density found so far on the disk is used to set up the decoders
+  mod_density|=mod_context.density;
+
+  mod_decodetrack(&mod_context, mod_density, mod_decoders);
+
+  return 1;
+}
+
+// Finish decoding a track once all its samples have arrived
+void mod_endstream()
+{
+  if (!mod_context.analysed)
+    return;
+
+  // If only some decoders were run and nothing was found, try the rest
+  if ((mod_decoders!=MOD_DECODEALL) && (diskstore_countsectors(mod_context.track, mod_context.head)==0))
+  {
+    if (mod_debug)
+      fprintf(stderr, "No sectors found on track %d head %d, trying remaining decoders\n", mod_context.track, mod_context.head);
+
+    mod_decodeflux(&mod_context, MOD_DECODEALL&~mod_decoders);
+  }
+}
+
+// Process samples captured from a given track/head, adding any sectors found to the diskstore
+void mod_processtrack(const unsigned char *sampledata, const unsigned long samplesize, const int format, const unsigned int track, const unsigned int head, const int attempt)
+{
+  mod_startstream(samplesize, track, head, format);
+
+  if (mod_streamsamples(sampledata, samplesize))
+    mod_endstream();
+}
+
+// Process samples captured from the current track/head
+void mod_process(const unsigned char *sampledata, const unsigned long samplesize, const int attempt)
+{
+  mod_processtrack(sampledata, samplesize, 0, hw_currenttrack, hw_currenthead, attempt);
+}
+
+// Build lookup tables to find level changes a byte at a time, and to reverse samples
+void mod_buildedgetables()
+{
+  int edges, j, k;
+  unsigned char last, pos;
+
+  for (edges=0; edges<256; edges++)
+  {
+    mod_edgecount[edges]=0;
+    last=0;
+
+    // Bits are sampled MSB first
+    for (j=0; j<BITSPERBYTE; j++)
+    {
+      if (edges&(0x80>>j))
+      {
+        mod_edgedelta[edges][mod_edgecount[edges]++]=(j+1)-last;
+        last=j+1;
+      }
+    }
+
+    mod_edgetail[edges]=BITSPERBYTE-last;
 
-      // Move on to next sample level (bit)
-      c=c<<1;
+    // With SPI samples, a change at the first sample is found at the gap sample and the rest are one sample later
+    last=0;
+    for (j=0, k=0; j<BITSPERBYTE; j++)
+    {
+      if (edges&(0x80>>j))
+      {
+        pos=(j==0)?1:(j+2);
+        mod_spiedgedelta[edges][k++]=pos-last;
+        last=pos;
+      }
+    }
+
+    mod_spiedgetail[edges]=(BITSPERBYTE+1)-last;
+
+    mod_reversebyte[edges]=0;
+    for (j=0; j<BITSPERBYTE; j++)
+    {
+      if (edges&(0x80>>j))
+        mod_reversebyte[edges]|=(0x01<<j);
     }
   }
 }
@@ -305,5 +987,23 @@ void mod_init(const int debug)
 {
   mod_debug=debug;
 
-  mod_peaks=0;
+  mod_buildedgetables();
+  applegcr_buildgcrdecodemaps();
+
+  mod_initcontext(&mod_context);
+
+  // Select the fastest available vector kernel
+#ifdef MOD_SIMDX86
+  __builtin_cpu_init();
+
+  if (__builtin_cpu_supports("avx2"))
+    mod_fluxkernel=mod_findchanges_avx2;
+  else
+  if (__builtin_cpu_supports("sse2"))
+    mod_fluxkernel=mod_findchanges_sse2;
+#endif
+
+#ifdef MOD_SIMDNEON
+  mod_fluxkernel=mod_findchanges_neon;
+#endif
 }
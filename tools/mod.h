@@ -1,9 +1,43 @@
 #ifndef _MOD_H_
 #define _MOD_H_
 
+#include <stdint.h>
+
+#include "fm.h"
+#include "mfm.h"
+#include "amigamfm.h"
+#include "gcr.h"
+#include "applegcr.h"
+
 #define MOD_HISTOGRAMSIZE 512
 #define MOD_PEAKSIZE 5
 
+// Most level changes possible within one byte of samples
+#define MOD_MAXEDGES 8
+
+// Decoders which can be run on flux
+#define MOD_DECODEFM 0x01
+#define MOD_DECODEAMIGAMFM 0x02
+#define MOD_DECODEMFM 0x04
+#define MOD_DECODEGCR 0x08
+#define MOD_DECODEAPPLEGCR 0x10
+#define MOD_DECODEALL 0x1f
+#define MOD_DECODERS 5
+
+// Bytes of samples searched at a time by vector kernels
+#define MOD_SIMDBLOCK 32
+
+// Flux run of 0 extends the following run by this many samples
+#define MOD_FLUXEXTEND 0xffff
+
+// Initial number of flux runs to allocate
+#define MOD_FLUXBLOCK 65536
+
+// Sample buffer formats
+#define MOD_SAMPLESSPI 0x01 // As sampled by SPI, with each byte following a gap sample which matches its first
+#define MOD_SAMPLESREVERSE 0x02 // Read from the end of the buffer backwards, for the reverse side of flippy disks
+#define MOD_SAMPLESRLE 0x04 // Held as run lengths, as in RFI files, rather than as samples
+
 #define MOD_DENSITYAUTO 0
 #define MOD_DENSITYFMSD 1
 #define MOD_DENSITYMFMDD 2
@@ -11,18 +45,109 @@
 #define MOD_DENSITYMFMED 8
 #define MOD_DENSITYAPPLEGCR 16
 
-extern unsigned long mod_datapos;
+// Run lengths which flux is extracted from, when samples are held as run lengths
+typedef struct ModRLE
+{
+  const unsigned char *data; // Samples at each level in turn, starting at 0, a run of 0 continues the previous level
+  unsigned long len;
+  unsigned long samples; // Samples covered by the run lengths, only in whole bytes and no more than the buffer, the rest are at level 0
+  unsigned long pos; // Next run length to use
+  unsigned long left; // Samples left of the run length being used
+  unsigned char level; // Level of the run length being used
+} Mod_RLE;
+
+// Flux transitions extracted from a buffer of samples
+typedef struct ModFlux
+{
+  uint16_t *runs; // Samples up to and including each level change
+  unsigned long len; // Number of runs in use
+  unsigned long size; // Number of runs allocated
+  unsigned long samples; // Total samples covered, including any after the last level change
+  unsigned char level; // Level of the first sample
+  unsigned long tail; // Samples after the last level change, carried into the next run when more samples arrive
+  unsigned char format; // How the samples are held in the buffer
+  Mod_RLE rle; // Run lengths, when samples are held as run lengths
+} Mod_Flux;
+
+// How far through the flux the decoders have got, so decoding can carry on as more flux arrives
+typedef struct ModCursor
+{
+  unsigned long run; // Next flux run to decode
+  unsigned long pos; // Samples before that run
+  unsigned long count; // Samples since the last rising edge
+  unsigned char level;
+} Mod_Cursor;
+
+// Everything needed to decode one track, so tracks can be decoded independently
+typedef struct ModContext
+{
+  // Physical position of the track being decoded
+  int track;
+  int head;
+
+  unsigned long samplerate;
+  int debug;
+
+  // Flux extracted from the samples
+  Mod_Flux flux;
+  Mod_Cursor cursor;
+
+  // Histogram of rising edge intervals
+  unsigned long hist[MOD_HISTOGRAMSIZE];
+  int peak[MOD_PEAKSIZE];
+  int peaks;
+
+  // Density detected on this track, once enough samples have been analysed
+  char density;
+  int analysed;
+
+  // Decoder state
+  FM_Context fm;
+  MFM_Context mfm;
+  AmigaMFM_Context amigamfm;
+  GCR_Context gcr;
+  AppleGCR_Context applegcr;
+
+  // Called for each good sector found, returns 1 if it was new
+  void *sinkdata;
+  int (*addsector)(struct ModContext *ctx, const unsigned char modulation, const unsigned char logical_track, const unsigned char logical_head, const unsigned char logical_sector, const unsigned char logical_size, const long id_pos, const unsigned int idcrc, const long data_pos, const long data_endpos, const unsigned int datatype, const unsigned int datasize, const unsigned char *data, const unsigned int datacrc);
+
+  // Returns 1 if a sector with this ID block is already held with good data for this track, so its data block can be skipped, NULL to read every data block
+  int (*hassector)(struct ModContext *ctx, const unsigned char logical_track, const unsigned char logical_head, const unsigned char logical_sector, const unsigned char logical_size, const unsigned int idcrc);
+} Mod_Context;
+
+extern Mod_Flux mod_flux;
+extern Mod_Context mod_context;
+
 extern unsigned long mod_samplesize;
 
-extern int mod_peak[MOD_PEAKSIZE];
-extern int mod_peaks;
 extern char mod_density;
+extern int mod_decoders;
+extern int mod_skipheld;
 
 unsigned char mod_getclock(const unsigned int datacells);
 unsigned char mod_getdata(const unsigned int datacells);
 
 extern float mod_samplestoms(const long samples);
 
+extern int mod_buildflux(Mod_Flux *flux, const unsigned char *sampledata, const unsigned long samplesize);
+extern int mod_buildrleflux(Mod_Flux *flux, const unsigned char *rledata, const unsigned long rlelen, const unsigned long samplesize);
+extern int mod_extendflux(Mod_Flux *flux, const unsigned char *sampledata, const unsigned long samplesize);
+extern int mod_extendspiflux(Mod_Flux *flux, const unsigned char *sampledata, const unsigned long samplesize);
+extern int mod_extendreverseflux(Mod_Flux *flux, const unsigned char *sampledata, const unsigned long samplesize);
+extern void mod_freeflux(Mod_Flux *flux);
+extern void mod_initcontext(Mod_Context *ctx);
+extern void mod_freecontext(Mod_Context *ctx);
+extern int mod_analysetrack(Mod_Context *ctx, const unsigned char *sampledata, const unsigned long samplesize);
+extern int mod_analyserletrack(Mod_Context *ctx, const unsigned char *rledata, const unsigned long rlelen, const unsigned long samplesize);
+extern void mod_decodeflux(Mod_Context *ctx, const int decoders);
+extern void mod_decodemore(Mod_Context *ctx, const int decoders);
+extern void mod_decodetrack(Mod_Context *ctx, const char density, const int decoders);
+extern void mod_startstream(const unsigned long samplesize, const unsigned int track, const unsigned int head, const int format);
+extern void mod_startrlestream(const unsigned char *rledata, const unsigned long rlelen, const unsigned long samplesize, const unsigned int track, const unsigned int head);
+extern int mod_streamsamples(const unsigned char *sampledata, const unsigned long samplesize);
+extern void mod_endstream();
+extern void mod_processtrack(const unsigned char *sampledata, const unsigned long samplesize, const int format, const unsigned int track, const unsigned int head, const int attempt);
 extern void mod_process(const unsigned char *sampledata, const unsigned long samplesize, const int attempt);
 
 extern void mod_init(const int debug);
@@ -5,6 +5,7 @@
 #include <unistd.h>
 #include <string.h>
 #include <strings.h>
+#include <time.h>
 
 #include "hardware.h"
 #include "rfi.h"
@@ -19,6 +20,10 @@ float hw_rpm = HW_DEFAULTRPM;
 
 int hw_stepping = HW_NORMALSTEPPING;
 
+int hw_spisamples = 0;
+
+unsigned int hw_rotationdelay = 0;
+
 FILE *hw_samplefile = NULL;
 char hw_samplefilename[1024];
 
@@ -111,75 +116,84 @@ int hw_writeprotected()
   return 0;
 }
 
-// Fix SPI sample buffer timings
-void hw_fixspisamples(char *inbuf, long inlen, char *outbuf, long outlen)
+// Fix SPI sample buffer timings in place, expanding the inlen bytes sampled at the start of buf to fill up to outlen bytes
+void hw_fixspisamples(char *buf, const long inlen, const long outlen)
 {
-  long inpos, outpos;
-  unsigned char c, o, olen, bitpos;
-
-  outpos=0; o=0; olen=0;
-
-  for (inpos=0; inpos<inlen; inpos++)
+  unsigned char samples[BITSPERBYTE];
+  unsigned char fixed[BITSPERBYTE+1];
+  long group, inpos, outpos;
+  unsigned int o, olen;
+  int i, ilen, flen;
+
+  // Each group of 8 bytes sampled becomes 9 bytes, so work back from the end to avoid overwriting samples not yet fixed
+  for (group=(inlen+(BITSPERBYTE-1))/BITSPERBYTE; group>0; group--)
   {
-    c=inbuf[inpos];
+    inpos=(group-1)*BITSPERBYTE;
+    outpos=(group-1)*(BITSPERBYTE+1);
 
-    // Insert extra sample, this is due to SPI sampling leaving a 1 sample gap between each group of 8 samples
-    o=(o<<1)|((c&0x80)>>7);
-    olen++;
-    if (olen==BITSPERBYTE)
-    {
-      if (outpos<outlen)
-        outbuf[outpos++]=o;
+    // Stop on output buffer overflow
+    if (outpos>=outlen) continue;
 
-      olen=0; o=0;
-    }
+    ilen=((inlen-inpos)<BITSPERBYTE)?(inlen-inpos):BITSPERBYTE;
+    for (i=0; i<ilen; i++)
+      samples[i]=buf[inpos+i];
+
+    o=0; olen=0; flen=0;
 
-    // Process the 8 valid samples we did get
-    for (bitpos=0; bitpos<BITSPERBYTE; bitpos++)
+    for (i=0; i<ilen; i++)
     {
-      o=(o<<1)|((c&0x80)>>7);
-      olen++;
+      // Insert extra sample, this is due to SPI sampling leaving a 1 sample gap between each group of 8 samples
+      o=(o<<(BITSPERBYTE+1))|((samples[i]&0x80)<<1)|samples[i];
+      olen+=(BITSPERBYTE+1);
 
-      if (olen==BITSPERBYTE)
+      while (olen>=BITSPERBYTE)
       {
-        if (outpos<outlen)
-          outbuf[outpos++]=o;
-
-        olen=0; o=0;
+        olen-=BITSPERBYTE;
+        fixed[flen++]=(o>>olen)&0xff;
       }
-
-      c=c<<1;
     }
 
-    // Stop on output buffer overflow
-    if (outpos>=outlen) return;
+    for (i=0; (i<flen) && ((outpos+i)<outlen); i++)
+      buf[outpos+i]=fixed[i];
   }
 }
 
-// Read raw flux data for current track/head
-void hw_samplerawtrackdata(char* buf, uint32_t len)
+// Open another handle on the sample file, so tracks can be read independently
+FILE *hw_opensamplefile()
 {
-  // Clear output buffer to prevent failed reads potentially returning previous data
-  bzero(buf, len);
+  return fopen(hw_samplefilename, "rb");
+}
+
+// Read raw flux data for given track/head from a sample file, SPI samples are only fixed when fix is set
+void hw_readsamplefile(FILE *samplefile, const unsigned int track, const unsigned int head, char* buf, uint32_t len, const int fix)
+{
+  uint32_t filled=0;
 
   // Find/Read track data into buffer
-  if (hw_samplefile!=NULL)
+  if (samplefile!=NULL)
   {
     // Obsolete .raw files were 8 megabits per track, sampled at 12.5Mhz, either 40 or 80 tracks, with second side (if any) folowing the whole of the first
     if (strstr(hw_samplefilename, ".raw")!=NULL)
     {
-      if (fseek(hw_samplefile, ((hw_maxtracks*hw_currenthead)+hw_currenttrack)*HW_OLDRAWTRACKSIZE, SEEK_SET)==0)
+      if (fseek(samplefile, ((hw_maxtracks*head)+track)*HW_OLDRAWTRACKSIZE, SEEK_SET)==0)
       {
-        char *rawbuf;
+        uint32_t rawlen;
 
-        rawbuf=malloc(HW_OLDRAWTRACKSIZE);
-        if (rawbuf==NULL) return;
+        // Only read as many samples as will fit once fixed, they are fixed in place
+        rawlen=fix?(((len+BITSPERBYTE)/(BITSPERBYTE+1))*BITSPERBYTE):len;
+        if (rawlen>len) rawlen=len;
+        if (rawlen>HW_OLDRAWTRACKSIZE) rawlen=HW_OLDRAWTRACKSIZE;
 
-        fread(rawbuf, HW_OLDRAWTRACKSIZE, 1, hw_samplefile);
+        rawlen=fread(buf, 1, rawlen, samplefile);
 
-        hw_fixspisamples(rawbuf, HW_OLDRAWTRACKSIZE, buf, len);
+        if (fix)
+        {
+          hw_fixspisamples(buf, rawlen, len);
 
-        free(rawbuf);
+          filled=(rawlen*(BITSPERBYTE+1))/BITSPERBYTE;
+        }
+        else
+          filled=rawlen;
       }
     }
     else
@@ -187,9 +201,136 @@ void hw_samplerawtrackdata(char* buf, uint32_t len)
     {
       long status;
 
-      status=rfi_readtrack(hw_samplefile, hw_currenttrack, hw_currenthead, buf, len);
+      status=rfi_readtrack(samplefile, track, head, buf, len);
+
+      if (status>0)
+        filled=status;
     }
   }
+
+  // Clear the rest of the buffer to prevent failed reads potentially returning previous data
+  if (filled<len)
+    bzero(&buf[filled], len-filled);
+}
+
+// Get the run lengths for given track/head from a sample file, when flux can be taken straight from them, returns NULL otherwise
+const unsigned char *hw_samplefilerle(FILE *samplefile, const unsigned int track, const unsigned int head, unsigned long *rlelen)
+{
+  if ((samplefile==NULL) || (strstr(hw_samplefilename, ".rfi")==NULL))
+    return NULL;
+
+  return rfi_trackrle(samplefile, track, head, rlelen);
+}
+
+// Read raw flux data for given track/head from a sample file
+void hw_samplefiletrack(FILE *samplefile, const unsigned int track, const unsigned int head, char* buf, uint32_t len)
+{
+  hw_readsamplefile(samplefile, track, head, buf, len, 1);
+}
+
+// Make a virtual capture take as long as a drive would to spin past the given number of samples
+void hw_rotationwait(const struct timespec *start, const uint32_t len)
+{
+  struct timespec now;
+  long long elapsed, delay;
+
+  if ((hw_rotationdelay==0) || (hw_samplerate==0))
+    return;
+
+  clock_gettime(CLOCK_MONOTONIC, &now);
+
+  elapsed=((now.tv_sec-start->tv_sec)*NSINSECOND)+(now.tv_nsec-start->tv_nsec);
+  delay=((((unsigned long long)len*BITSPERBYTE*HW_ROTATIONSPERSEC)*hw_rotationdelay*1000)/hw_samplerate)*NSINUS;
+
+  if (delay>elapsed)
+    usleep((delay-elapsed)/NSINUS);
+}
+
+// Read raw flux data for current track/head
+void hw_samplerawtrackdata(char* buf, uint32_t len)
+{
+  struct timespec start;
+
+  clock_gettime(CLOCK_MONOTONIC, &start);
+
+  hw_samplefiletrack(hw_samplefile, hw_currenttrack, hw_currenthead, buf, len);
+
+  hw_rotationwait(&start, len);
+}
+
+// Read raw flux data for current track/head a chunk at a time, returns how much of the buffer has been filled so far
+uint32_t hw_samplerawtrackchunk(char* buf, uint32_t len, uint32_t filled, uint32_t chunklen)
+{
+  struct timespec start;
+
+  clock_gettime(CLOCK_MONOTONIC, &start);
+
+  // Whole track is read from the sample file up front, then handed out as a drive would deliver it
+  if (filled==0)
+    hw_samplefiletrack(hw_samplefile, hw_currenttrack, hw_currenthead, buf, len);
+
+  if (filled>=len)
+    return len;
+
+  if (chunklen>(len-filled))
+    chunklen=len-filled;
+
+  hw_rotationwait(&start, chunklen);
+
+  return filled+chunklen;
+}
+
+// Read raw flux data for current track/head a chunk at a time, leaving any SPI samples unfixed, returns how much of the buffer has been filled so far
+//   chunklen is in bytes of fixed samples, each byte sampled by SPI covers 9 samples so fewer bytes are needed
+uint32_t hw_samplespitrackchunk(char* buf, uint32_t len, uint32_t filled, uint32_t chunklen)
+{
+  struct timespec start;
+  uint32_t rawlen;
+
+  clock_gettime(CLOCK_MONOTONIC, &start);
+
+  // Whole track is read from the sample file up front, then handed out as a drive would deliver it
+  if (filled==0)
+    hw_readsamplefile(hw_samplefile, hw_currenttrack, hw_currenthead, buf, len, 0);
+
+  if (filled>=len)
+    return len;
+
+  rawlen=hw_spisamples?(((chunklen+BITSPERBYTE)/(BITSPERBYTE+1))*BITSPERBYTE):chunklen;
+
+  if (rawlen>(len-filled))
+    rawlen=len-filled;
+
+  hw_rotationwait(&start, hw_spisamples?((rawlen*(BITSPERBYTE+1))/BITSPERBYTE):rawlen);
+
+  return filled+rawlen;
+}
+
+// Get the run lengths for current track/head, handing them out a chunk at a time as a drive would deliver the samples
+//   returns how many bytes of samples have been covered so far, or 0 when the track isn't held as run lengths
+uint32_t hw_samplerletrackchunk(const unsigned char **rledata, unsigned long *rlelen, uint32_t len, uint32_t filled, uint32_t chunklen)
+{
+  struct timespec start;
+
+  clock_gettime(CLOCK_MONOTONIC, &start);
+
+  if (filled==0)
+  {
+    *rledata=hw_samplefilerle(hw_samplefile, hw_currenttrack, hw_currenthead, rlelen);
+
+    if (*rledata==NULL)
+      return 0;
+  }
+
+  if (filled>=len)
+    return len;
+
+  if (chunklen>(len-filled))
+    chunklen=len-filled;
+
+  hw_rotationwait(&start, chunklen);
+
+  return filled+chunklen;
 }
 
 // Clean up
@@ -202,6 +343,11 @@ void hw_done()
 
     hw_samplefile=NULL;
   }
+
+  rfi_freeindex();
+  rfi_unmap();
+
+  hw_freebuffers();
 }
 
 // Initialisation
@@ -220,6 +366,9 @@ int hw_init(const char *rawfile, const int spiclockdivider)
   // Open sample file
   hw_samplefile=fopen(rawfile, "rb");
 
+  // Obsolete .raw files hold samples as they were sampled by SPI
+  hw_spisamples=(strstr(hw_samplefilename, ".raw")!=NULL);
+
   // If RFI opened and valid, read header values to determine capture settings
   if ((hw_samplefile!=NULL) && (strstr(hw_samplefilename, ".rfi")!=NULL))
   {
@@ -0,0 +1,201 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <pthread.h>
+
+#include "diskstore.h"
+#include "mod.h"
+#include "pipeline.h"
+
+// Track being decoded
+Pipeline_Job pipeline_job;
+int pipeline_active=0;
+
+int pipeline_running=0;
+int pipeline_stopping=0;
+
+pthread_t pipeline_thread;
+
+// Protects all of the above once the thread is running
+pthread_mutex_t pipeline_lock=PTHREAD_MUTEX_INITIALIZER;
+pthread_cond_t pipeline_changed=PTHREAD_COND_INITIALIZER;
+
+// Decode each track as its samples are captured
+void *pipeline_worker(void *arg)
+{
+  const unsigned char *samplebuffer;
+  const unsigned char *expected;
+  unsigned int track, head;
+  unsigned long samplesize, decoded, filled;
+  int format, finished, ok;
+
+  (void) arg;
+
+  while (1)
+  {
+    pthread_mutex_lock(&pipeline_lock);
+
+    while ((pipeline_stopping==0) && (pipeline_active==0))
+      pthread_cond_wait(&pipeline_changed, &pipeline_lock);
+
+    if (pipeline_active==0)
+    {
+      pthread_mutex_unlock(&pipeline_lock);
+      break;
+    }
+
+    samplebuffer=pipeline_job.samplebuffer;
+    samplesize=pipeline_job.samplesize;
+    format=pipeline_job.format;
+    track=pipeline_job.track;
+    head=pipeline_job.head;
+    expected=pipeline_job.expected;
+
+    pthread_mutex_unlock(&pipeline_lock);
+
+    mod_startstream(samplesize, track, head, format);
+    decoded=0;
+    ok=1;
+
+    while (1)
+    {
+      pthread_mutex_lock(&pipeline_lock);
+
+      while ((pipeline_job.filled==decoded) && (pipeline_job.finished==0))
+        pthread_cond_wait(&pipeline_changed, &pipeline_lock);
+
+      filled=pipeline_job.filled;
+      finished=pipeline_job.finished;
+
+      pthread_mutex_unlock(&pipeline_lock);
+
+      if ((filled>decoded) && (ok))
+      {
+        ok=mod_streamsamples(samplebuffer, filled);
+
+        // Let the capture stop early once every sector expected has been found
+        if ((ok) && (expected!=NULL) && (diskstore_hassectormap(track, head, expected)))
+        {
+          pthread_mutex_lock(&pipeline_lock);
+
+          pipeline_job.complete=1;
+          pthread_cond_broadcast(&pipeline_changed);
+
+          pthread_mutex_unlock(&pipeline_lock);
+        }
+      }
+
+      decoded=filled;
+
+      if (finished)
+        break;
+    }
+
+    if (ok)
+      mod_endstream();
+
+    pthread_mutex_lock(&pipeline_lock);
+
+    pipeline_active=0;
+    pthread_cond_broadcast(&pipeline_changed);
+
+    pthread_mutex_unlock(&pipeline_lock);
+  }
+
+  return NULL;
+}
+
+// Start the decoding thread, returns 1 on success
+int pipeline_start()
+{
+  pipeline_active=0;
+  pipeline_stopping=0;
+
+  if (pthread_create(&pipeline_thread, NULL, pipeline_worker, NULL)!=0)
+    return 0;
+
+  pipeline_running=1;
+
+  return 1;
+}
+
+// Start decoding a track, samples are passed to the decoders as they are captured
+void pipeline_decode(const unsigned char *samplebuffer, const unsigned long samplesize, const int format, const unsigned int track, const unsigned int head, const int attempt, const unsigned char *expected)
+{
+  pthread_mutex_lock(&pipeline_lock);
+
+  // Only one track is decoded at a time
+  while (pipeline_active!=0)
+    pthread_cond_wait(&pipeline_changed, &pipeline_lock);
+
+  pipeline_job.samplebuffer=samplebuffer;
+  pipeline_job.samplesize=samplesize;
+  pipeline_job.format=format;
+  pipeline_job.track=track;
+  pipeline_job.head=head;
+  pipeline_job.attempt=attempt;
+  pipeline_job.expected=expected;
+  pipeline_job.filled=0;
+  pipeline_job.finished=0;
+  pipeline_job.complete=0;
+
+  pipeline_active=1;
+  pthread_cond_broadcast(&pipeline_changed);
+
+  pthread_mutex_unlock(&pipeline_lock);
+}
+
+// Let the decoding thread know more samples have been captured
+void pipeline_addsamples(const unsigned long filled)
+{
+  pthread_mutex_lock(&pipeline_lock);
+
+  pipeline_job.filled=filled;
+  pthread_cond_broadcast(&pipeline_changed);
+
+  pthread_mutex_unlock(&pipeline_lock);
+}
+
+// Check if all the sectors expected on the track have been found
+int pipeline_complete()
+{
+  int complete;
+
+  pthread_mutex_lock(&pipeline_lock);
+
+  complete=pipeline_job.complete;
+
+  pthread_mutex_unlock(&pipeline_lock);
+
+  return complete;
+}
+
+// Wait for the track to be decoded once capture has stopped, after which the diskstore may be used
+void pipeline_finish()
+{
+  pthread_mutex_lock(&pipeline_lock);
+
+  pipeline_job.finished=1;
+  pthread_cond_broadcast(&pipeline_changed);
+
+  while (pipeline_active!=0)
+    pthread_cond_wait(&pipeline_changed, &pipeline_lock);
+
+  pthread_mutex_unlock(&pipeline_lock);
+}
+
+// Stop the decoding thread
+void pipeline_stop()
+{
+  if (pipeline_running==0) return;
+
+  pthread_mutex_lock(&pipeline_lock);
+
+  pipeline_stopping=1;
+  pthread_cond_broadcast(&pipeline_changed);
+
+  pthread_mutex_unlock(&pipeline_lock);
+
+  pthread_join(pipeline_thread, NULL);
+
+  pipeline_running=0;
+}
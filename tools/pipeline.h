@@ -0,0 +1,52 @@
+#ifndef _PIPELINE_H_
+#define _PIPELINE_H_
+
+#include <pthread.h>
+
+// A track being decoded whilst it is still being captured
+typedef struct PipelineJob
+{
+  const unsigned char *samplebuffer;
+  unsigned long samplesize;
+
+  // How the samples are held in the buffer
+  int format;
+
+  // Physical position the track is being captured from
+  unsigned int track;
+  unsigned int head;
+
+  int attempt;
+
+  // Map of the logical sector IDs expected on the track, NULL when not known
+  const unsigned char *expected;
+
+  // Bytes of samples captured so far
+  unsigned long filled;
+
+  // Set once capture has stopped
+  int finished;
+
+  // Set once all the expected sectors have been found
+  int complete;
+} Pipeline_Job;
+
+// Start the decoding thread, returns 1 on success
+extern int pipeline_start();
+
+// Start decoding a track, samples are passed to the decoders as they are captured
+extern void pipeline_decode(const unsigned char *samplebuffer, const unsigned long samplesize, const int format, const unsigned int track, const unsigned int head, const int attempt, const unsigned char *expected);
+
+// Let the decoding thread know more samples have been captured
+extern void pipeline_addsamples(const unsigned long filled);
+
+// Check if all the sectors expected on the track have been found
+extern int pipeline_complete();
+
+// Wait for the track to be decoded once capture has stopped, after which the diskstore may be used
+extern void pipeline_finish();
+
+// Stop the decoding thread
+extern void pipeline_stop();
+
+#endif
@@ -0,0 +1,414 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "hardware.h"
+#include "diskstore.h"
+#include "mod.h"
+#include "pool.h"
+
+// Tracks to decode, in the order they will be collected
+Pool_Job *pool_jobs=NULL;
+unsigned int pool_numjobs=0;
+unsigned int pool_maxjobs=0;
+
+unsigned int pool_nextjob=0; // Next track for a thread to decode
+unsigned int pool_collected=0; // Next track to be collected
+
+Pool_Worker pool_workers[POOL_MAXTHREADS];
+int pool_numworkers=0;
+int pool_stopping=0;
+
+// Settings from when the pool was started
+unsigned long pool_samplesize=0;
+char pool_density=MOD_DENSITYAUTO;
+int pool_decoders=MOD_DECODEALL;
+
+// Protects all of the above once threads are running
+pthread_mutex_t pool_lock=PTHREAD_MUTEX_INITIALIZER;
+pthread_cond_t pool_changed=PTHREAD_COND_INITIALIZER;
+
+// Keep a copy of each sector found, to be added to the diskstore when the track is collected
+int pool_queuesector(Mod_Context *ctx, const unsigned char modulation, const unsigned char logical_track, const unsigned char logical_head, const unsigned char logical_sector, const unsigned char logical_size, const long id_pos, const unsigned int idcrc, const long data_pos, const long data_endpos, const unsigned int datatype, const unsigned int datasize, const unsigned char *data, const unsigned int datacrc)
+{
+  Pool_Job *job;
+  Disk_Sector *newitem;
+
+  job=(Pool_Job *)ctx->sinkdata;
+
+  newitem=malloc(sizeof(Disk_Sector));
+  if (newitem==NULL) return 0;
+
+  newitem->data=malloc(datasize);
+  if (newitem->data==NULL)
+  {
+    free(newitem);
+    return 0;
+  }
+
+  memcpy(newitem->data, data, datasize);
+
+  newitem->physical_track=ctx->track;
+  newitem->physical_head=ctx->head;
+
+  newitem->logical_track=logical_track;
+  newitem->logical_head=logical_head;
+  newitem->logical_sector=logical_sector;
+  newitem->logical_size=logical_size;
+  newitem->idcrc=idcrc;
+  newitem->id_pos=id_pos;
+  newitem->data_pos=data_pos;
+  newitem->data_endpos=data_endpos;
+
+  newitem->modulation=modulation;
+
+  newitem->datatype=datatype;
+  newitem->datasize=datasize;
+  newitem->datacrc=datacrc;
+
+  newitem->next=NULL;
+
+  if (job->lastsector==NULL)
+    job->sectors=newitem;
+  else
+    job->lastsector->next=newitem;
+
+  job->lastsector=newitem;
+
+  job->sectormap[logical_sector/8]|=(1<<(logical_sector%8));
+
+  return 1;
+}
+
+// Check the sectors found so far for this track, the diskstore is being added to by the main thread
+int pool_hassector(Mod_Context *ctx, const unsigned char logical_track, const unsigned char logical_head, const unsigned char logical_sector, const unsigned char logical_size, const unsigned int idcrc)
+{
+  Pool_Job *job;
+  Disk_Sector *curr;
+
+  job=(Pool_Job *)ctx->sinkdata;
+
+  // No need to search if this sector ID hasn't been found
+  if ((job->sectormap[logical_sector/8]&(1<<(logical_sector%8)))==0)
+    return 0;
+
+  for (curr=job->sectors; curr!=NULL; curr=curr->next)
+  {
+    if ((curr->logical_track==logical_track) &&
+        (curr->logical_head==logical_head) &&
+        (curr->logical_sector==logical_sector) &&
+        (curr->logical_size==logical_size) &&
+        (curr->idcrc==idcrc))
+      return 1;
+  }
+
+  return 0;
+}
+
+// Free any sectors found on a track which have not been collected
+void pool_freesectors(Pool_Job *job)
+{
+  Disk_Sector *curr;
+  Disk_Sector *next;
+
+  for (curr=job->sectors; curr!=NULL; curr=next)
+  {
+    next=curr->next;
+
+    free(curr->data);
+    free(curr);
+  }
+
+  job->sectors=NULL;
+  job->lastsector=NULL;
+}
+
+// Read and decode tracks until there are none left
+void *pool_worker(void *arg)
+{
+  Pool_Worker *worker;
+  Mod_Context *ctx;
+  Pool_Job *job;
+  const unsigned char *rledata;
+  unsigned long rlelen;
+  unsigned int n, j;
+  char density;
+  int analysed;
+
+  worker=(Pool_Worker *)arg;
+  ctx=worker->ctx;
+
+  while (1)
+  {
+    pthread_mutex_lock(&pool_lock);
+
+    // Wait for a track to decode, without getting too far ahead of those collected
+    while ((pool_stopping==0) && (pool_nextjob<pool_numjobs) && (pool_nextjob>=(pool_collected+(pool_numworkers*POOL_AHEAD))))
+      pthread_cond_wait(&pool_changed, &pool_lock);
+
+    if ((pool_stopping!=0) || (pool_nextjob>=pool_numjobs))
+    {
+      pthread_mutex_unlock(&pool_lock);
+      break;
+    }
+
+    n=pool_nextjob++;
+    job=&pool_jobs[n];
+
+    pthread_mutex_unlock(&pool_lock);
+
+    ctx->track=job->track;
+    ctx->head=job->head;
+    ctx->samplerate=hw_samplerate;
+    ctx->sinkdata=job;
+
+    // Take flux straight from run lengths when the track is held as them, otherwise read the samples
+    rledata=hw_samplefilerle(worker->samplefile, job->track, job->head, &rlelen);
+
+    if (rledata!=NULL)
+      analysed=mod_analyserletrack(ctx, rledata, rlelen, pool_samplesize);
+    else
+    {
+      hw_samplefiletrack(worker->samplefile, job->track, job->head, (char *)worker->samplebuffer, pool_samplesize);
+
+      analysed=mod_analysetrack(ctx, worker->samplebuffer, pool_samplesize);
+    }
+
+    if (!analysed)
+      fprintf(stderr, "Unable to allocate flux buffer\n");
+
+    pthread_mutex_lock(&pool_lock);
+
+    job->density=(analysed?ctx->density:MOD_DENSITYAUTO);
+    job->analysed=1;
+    pthread_cond_broadcast(&pool_changed);
+
+    // Set up the decoders with the density found on all the tracks up to this one, as if decoded in order
+    density=pool_density;
+    for (j=0; j<=n; j++)
+    {
+      while ((pool_jobs[j].analysed==0) && (pool_stopping==0))
+        pthread_cond_wait(&pool_changed, &pool_lock);
+
+      density|=pool_jobs[j].density;
+    }
+
+    if (pool_stopping!=0)
+      analysed=0;
+
+    pthread_mutex_unlock(&pool_lock);
+
+    if (analysed)
+    {
+      mod_decodetrack(ctx, density, pool_decoders);
+
+      // If only some decoders were run and nothing was found, try the rest
+      if ((pool_decoders!=MOD_DECODEALL) && (job->known==0) && (job->sectors==NULL))
+      {
+        if (ctx->debug)
+          fprintf(stderr, "No sectors found on track %d head %d, trying remaining decoders\n", ctx->track, ctx->head);
+
+        mod_decodeflux(ctx, MOD_DECODEALL&~pool_decoders);
+      }
+    }
+
+    pthread_mutex_lock(&pool_lock);
+
+    job->done=1;
+    pthread_cond_broadcast(&pool_changed);
+
+    pthread_mutex_unlock(&pool_lock);
+  }
+
+  return NULL;
+}
+
+// Add a track to be decoded, tracks are collected in the order they are added
+int pool_addtrack(const unsigned int track, const unsigned int head)
+{
+  Pool_Job *job;
+
+  // Make sure there is space for another track
+  if (pool_numjobs>=pool_maxjobs)
+  {
+    Pool_Job *newjobs;
+    unsigned int newmax;
+
+    newmax=(pool_maxjobs==0)?(HW_MAXTRACKS*HW_MAXHEADS):(pool_maxjobs*2);
+    newjobs=realloc(pool_jobs, newmax*sizeof(Pool_Job));
+
+    if (newjobs==NULL)
+      return 0;
+
+    pool_jobs=newjobs;
+    pool_maxjobs=newmax;
+  }
+
+  job=&pool_jobs[pool_numjobs++];
+
+  job->track=track;
+  job->head=head;
+  job->known=diskstore_countsectors(track, head);
+  job->density=MOD_DENSITYAUTO;
+  job->analysed=0;
+  job->done=0;
+  job->sectors=NULL;
+  job->lastsector=NULL;
+  memset(job->sectormap, 0, sizeof(job->sectormap));
+
+  return 1;
+}
+
+// Free resources allocated to a thread
+void pool_freeworker(Pool_Worker *worker)
+{
+  if (worker->ctx!=NULL)
+  {
+    mod_freecontext(worker->ctx);
+    free(worker->ctx);
+    worker->ctx=NULL;
+  }
+
+  if (worker->samplebuffer!=NULL)
+  {
+    hw_releasebuffer((char *)worker->samplebuffer);
+    worker->samplebuffer=NULL;
+  }
+
+  if (worker->samplefile!=NULL)
+  {
+    fclose(worker->samplefile);
+    worker->samplefile=NULL;
+  }
+}
+
+// Start decoding the added tracks, returns the number of threads started
+int pool_start(const int threads, const unsigned long samplesize)
+{
+  Pool_Worker *worker;
+  int i;
+
+  if (pool_numjobs==0) return 0;
+
+  pool_samplesize=samplesize;
+  pool_density=mod_density;
+  pool_decoders=mod_decoders;
+
+  pool_nextjob=0;
+  pool_collected=0;
+  pool_stopping=0;
+  pool_numworkers=0;
+
+  // Allocate everything each thread needs up front
+  for (i=0; (i<threads) && (i<POOL_MAXTHREADS); i++)
+  {
+    worker=&pool_workers[i];
+
+    worker->ctx=malloc(sizeof(Mod_Context));
+    worker->samplebuffer=(unsigned char *)hw_acquirebuffer(samplesize);
+    worker->samplefile=hw_opensamplefile();
+
+    if ((worker->ctx==NULL) || (worker->samplebuffer==NULL) || (worker->samplefile==NULL))
+    {
+      pool_freeworker(worker);
+      break;
+    }
+
+    mod_initcontext(worker->ctx);
+    worker->ctx->addsector=pool_queuesector;
+    if (mod_skipheld)
+      worker->ctx->hassector=pool_hassector;
+
+    pool_numworkers++;
+  }
+
+  // Hold the threads back until they have all been started
+  pthread_mutex_lock(&pool_lock);
+
+  for (i=0; i<pool_numworkers; i++)
+  {
+    if (pthread_create(&pool_workers[i].thread, NULL, pool_worker, &pool_workers[i])!=0)
+    {
+      int j;
+
+      for (j=i; j<pool_numworkers; j++)
+        pool_freeworker(&pool_workers[j]);
+
+      pool_numworkers=i;
+      break;
+    }
+  }
+
+  pthread_mutex_unlock(&pool_lock);
+
+  return pool_numworkers;
+}
+
+// Wait for the next track to be decoded then add its sectors to the diskstore
+void pool_collect()
+{
+  Pool_Job *job;
+  Disk_Sector *curr;
+
+  pthread_mutex_lock(&pool_lock);
+
+  if (pool_collected>=pool_numjobs)
+  {
+    pthread_mutex_unlock(&pool_lock);
+    return;
+  }
+
+  job=&pool_jobs[pool_collected];
+
+  while (job->done==0)
+    pthread_cond_wait(&pool_changed, &pool_lock);
+
+  pthread_mutex_unlock(&pool_lock);
+
+  // Add sectors in the order they were found, as if the track had been decoded here
+  for (curr=job->sectors; curr!=NULL; curr=curr->next)
+    diskstore_addsector(curr->modulation, curr->physical_track, curr->physical_head, curr->logical_track, curr->logical_head, curr->logical_sector, curr->logical_size, curr->id_pos, curr->idcrc, curr->data_pos, curr->data_endpos, curr->datatype, curr->datasize, curr->data, curr->datacrc);
+
+  pool_freesectors(job);
+
+  mod_density|=job->density;
+  mod_samplesize=pool_samplesize;
+
+  pthread_mutex_lock(&pool_lock);
+
+  pool_collected++;
+  pthread_cond_broadcast(&pool_changed);
+
+  pthread_mutex_unlock(&pool_lock);
+}
+
+// Stop the decoding threads and free any tracks not collected
+void pool_stop()
+{
+  unsigned int n;
+  int i;
+
+  pthread_mutex_lock(&pool_lock);
+
+  pool_stopping=1;
+  pthread_cond_broadcast(&pool_changed);
+
+  pthread_mutex_unlock(&pool_lock);
+
+  for (i=0; i<pool_numworkers; i++)
+  {
+    pthread_join(pool_workers[i].thread, NULL);
+    pool_freeworker(&pool_workers[i]);
+  }
+
+  pool_numworkers=0;
+
+  for (n=0; n<pool_numjobs; n++)
+    pool_freesectors(&pool_jobs[n]);
+
+  free(pool_jobs);
+  pool_jobs=NULL;
+  pool_numjobs=0;
+  pool_maxjobs=0;
+}
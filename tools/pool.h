@@ -0,0 +1,61 @@
+#ifndef _POOL_H_
+#define _POOL_H_
+
+#include <stdio.h>
+#include <pthread.h>
+
+#include "diskstore.h"
+#include "mod.h"
+
+// Most decoding threads supported
+#define POOL_MAXTHREADS 64
+
+// Number of tracks each thread may decode ahead of those collected
+#define POOL_AHEAD 2
+
+// A track to be read and decoded by the pool
+typedef struct PoolJob
+{
+  // Physical position of track
+  unsigned int track;
+  unsigned int head;
+
+  // Sectors already stored for this track before it was decoded
+  unsigned char known;
+
+  // Density found on this track, once analysed
+  char density;
+  int analysed;
+
+  int done;
+
+  // Sectors found, in the order the decoders found them
+  Disk_Sector *sectors;
+  Disk_Sector *lastsector;
+
+  // Logical sector IDs found, so decoders can check without the diskstore
+  unsigned char sectormap[DISKSTORE_SECTORMAPSIZE];
+} Pool_Job;
+
+// A decoding thread, with its own context, buffer and handle on the sample file
+typedef struct PoolWorker
+{
+  pthread_t thread;
+  Mod_Context *ctx;
+  unsigned char *samplebuffer;
+  FILE *samplefile;
+} Pool_Worker;
+
+// Add a track to be decoded, tracks are collected in the order they are added
+extern int pool_addtrack(const unsigned int track, const unsigned int head);
+
+// Start decoding the added tracks
+extern int pool_start(const int threads, const unsigned long samplesize);
+
+// Wait for the next track to be decoded then add its sectors to the diskstore
+extern void pool_collect();
+
+// Stop the decoding threads and free any tracks not collected
+extern void pool_stop();
+
+#endif
@@ -4,10 +4,25 @@
 #include <strings.h>
 #include <time.h>
 #include <sys/time.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
 #include "hardware.h"
+#include "mod.h"
 #include "rfi.h"
 #include "jsmn.h"
+#include "crc.h"
+#include "byteorder.h"
+
+// Most JSON tokens expected in a track header
+#define RFI_MAXTRACKTOKENS 64
+
+// Initial number of tracks to allocate in the index
+#define RFI_INDEXBLOCK 168
+
+// Bytes of RLE track data read from the file at a time
+#define RFI_RLEBLOCK 4096
 
 char *rfi_headerstring = NULL;
 unsigned int rfi_headerlen = 0;
@@ -18,6 +33,45 @@ int rfi_sides = 0;
 long rfi_rate = 0;
 unsigned char rfi_writeable = 0;
 
+// Where each track is in the file, found when the header is read
+RFI_Track *rfi_index = NULL;
+unsigned int rfi_indexlen = 0;
+unsigned int rfi_indexsize = 0;
+
+// Input file mapped into memory, so track data can be decoded where it is without copying
+const unsigned char *rfi_map = NULL;
+size_t rfi_maplen = 0;
+dev_t rfi_mapdev = 0;
+ino_t rfi_mapino = 0;
+
+// Tracks written so far, to be listed in the index when the file is finalised
+RFI_Track *rfi_written = NULL;
+unsigned int rfi_writtenlen = 0;
+unsigned int rfi_writtensize = 0;
+
+// Add a track to a list of tracks, growing it as needed, returns 1 on success
+int rfi_addtrack(RFI_Track **list, unsigned int *len, unsigned int *size, const RFI_Track *info)
+{
+  if ((*len)>=(*size))
+  {
+    RFI_Track *newlist;
+    unsigned int newsize;
+
+    newsize=((*size)==0)?RFI_INDEXBLOCK:((*size)*2);
+    newlist=realloc(*list, newsize*sizeof(RFI_Track));
+
+    if (newlist==NULL)
+      return 0;
+
+    *list=newlist;
+    *size=newsize;
+  }
+
+  (*list)[(*len)++]=(*info);
+
+  return 1;
+}
+
 // Write file metadata
 void rfi_writeheader(FILE *rfifile, const int tracks, const int sides, const long rate, const unsigned char writeable)
 {
@@ -34,6 +88,322 @@ void rfi_writeheader(FILE *rfifile, const int tracks, const int sides, const lon
   fprintf(rfifile, "{date:\"%02d/%02d/%d\",time:\"%02d:%02d:%02d\",tracks:%d,sides:%d,rate:%ld,writeable:%d}", tim.tm_mday, tim.tm_mon+1, tim.tm_year+1900, tim.tm_hour, tim.tm_min, tim.tm_sec, tracks, sides, rate, writeable);
 }
 
+// Read the track metadata at the current position in the file, leaving the file at the start of the track data, returns 1 on success
+int rfi_readtrackheader(FILE *rfifile, RFI_Track *info)
+{
+  jsmn_parser parser;
+  jsmntok_t tokens[RFI_MAXTRACKTOKENS];
+  int numtokens;
+  long metapos;
+  size_t metalen;
+  int i;
+
+  char metabuffer[1024];
+
+  // Initialise track metadata
+  info->track=-1;
+  info->side=-1;
+  info->rpm=-1;
+  info->encoding[0]=0;
+  info->len=0;
+  info->offset=0;
+  info->hascrc=0;
+  info->crc=0;
+  info->verified=0;
+
+  // Read track metadata
+  metapos=ftell(rfifile);
+
+  if (metapos==-1)
+    return 0;
+
+  // The last track header may be within the last 1k of the file
+  metalen=fread(metabuffer, 1, sizeof(metabuffer)-1, rfifile);
+
+  if (metalen==0)
+    return 0;
+
+  metabuffer[metalen]=0;
+
+  for (i=0; i<(int)metalen; i++)
+  {
+    if (metabuffer[i]=='}')
+    {
+      metabuffer[i+1]=0;
+      break;
+    }
+  }
+
+  // Quick check for validty and to count the tokens
+  jsmn_init(&parser);
+  numtokens=jsmn_parse(&parser, metabuffer, metalen, NULL, 0);
+
+  if ((numtokens<=0) || (numtokens>RFI_MAXTRACKTOKENS))
+    return 0;
+
+  jsmn_init(&parser);
+  numtokens=jsmn_parse(&parser, metabuffer, metalen, tokens, numtokens);
+
+  // Move file pointer to first byte after track header
+  info->offset=metapos+tokens[0].end;
+
+  if (fseek(rfifile, info->offset, SEEK_SET)!=0)
+    return 0;
+
+  for (i=0; i<numtokens; i++)
+  {
+    char rfic;
+
+    if ((tokens[i].type==JSMN_PRIMITIVE) && (tokens[i].size==1) && ((i+1)<=numtokens))
+    {
+      if (strncmp(&metabuffer[tokens[i].start], "enc", tokens[i].end-tokens[i].start)==0)
+      {
+        rfic=metabuffer[tokens[i+1].end];
+        metabuffer[tokens[i+1].end]=0;
+
+        if (strlen(&metabuffer[tokens[i+1].start])<sizeof(info->encoding))
+          strcpy(info->encoding, &metabuffer[tokens[i+1].start]);
+
+        metabuffer[tokens[i+1].end]=rfic;
+      }
+      else
+      if (strncmp(&metabuffer[tokens[i].start], "track", tokens[i].end-tokens[i].start)==0)
+      {
+        rfic=metabuffer[tokens[i+1].end];
+        metabuffer[tokens[i+1].end]=0;
+
+        sscanf(&metabuffer[tokens[i+1].start], "%3d", &info->track);
+
+        metabuffer[tokens[i+1].end]=rfic;
+      }
+      else
+      if (strncmp(&metabuffer[tokens[i].start], "side", tokens[i].end-tokens[i].start)==0)
+      {
+        rfic=metabuffer[tokens[i+1].end];
+        metabuffer[tokens[i+1].end]=0;
+
+        sscanf(&metabuffer[tokens[i+1].start], "%1d", &info->side);
+
+        metabuffer[tokens[i+1].end]=rfic;
+      }
+      else
+      if (strncmp(&metabuffer[tokens[i].start], "rpm", tokens[i].end-tokens[i].start)==0)
+      {
+        rfic=metabuffer[tokens[i+1].end];
+        metabuffer[tokens[i+1].end]=0;
+
+        sscanf(&metabuffer[tokens[i+1].start], "%8f", &info->rpm);
+
+        metabuffer[tokens[i+1].end]=rfic;
+      }
+      else
+      if (strncmp(&metabuffer[tokens[i].start], "len", tokens[i].end-tokens[i].start)==0)
+      {
+        rfic=metabuffer[tokens[i+1].end];
+        metabuffer[tokens[i+1].end]=0;
+
+        sscanf(&metabuffer[tokens[i+1].start], "%8lu", &info->len);
+
+        metabuffer[tokens[i+1].end]=rfic;
+      }
+    }
+  }
+
+  return 1;
+}
+
+// Free the track index
+void rfi_freeindex()
+{
+  if (rfi_index!=NULL)
+    free(rfi_index);
+
+  rfi_index=NULL;
+  rfi_indexlen=0;
+  rfi_indexsize=0;
+}
+
+// Unmap the input file, if mapped
+void rfi_unmap()
+{
+  if (rfi_map!=NULL)
+    munmap((void *)rfi_map, rfi_maplen);
+
+  rfi_map=NULL;
+  rfi_maplen=0;
+  rfi_mapdev=0;
+  rfi_mapino=0;
+}
+
+// Map the whole input file into memory, otherwise tracks are read with stdio
+void rfi_mapfile(FILE *rfifile)
+{
+  struct stat st;
+  void *map;
+
+  rfi_unmap();
+
+  if ((fstat(fileno(rfifile), &st)!=0) || (!S_ISREG(st.st_mode)) || (st.st_size<=0))
+    return;
+
+  // Files too big for the address space can still be read without the mapping
+  if ((unsigned long long)st.st_size>(size_t)-1)
+    return;
+
+  map=mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fileno(rfifile), 0);
+
+  if (map==MAP_FAILED)
+    return;
+
+  rfi_map=map;
+  rfi_maplen=st.st_size;
+  rfi_mapdev=st.st_dev;
+  rfi_mapino=st.st_ino;
+}
+
+// Get the mapping for a file, as each thread may have its own handle to the same file, returns NULL if not mapped
+const unsigned char *rfi_getmap(FILE *rfifile)
+{
+  struct stat st;
+
+  if (rfi_map==NULL)
+    return NULL;
+
+  if ((fstat(fileno(rfifile), &st)!=0) || (st.st_dev!=rfi_mapdev) || (st.st_ino!=rfi_mapino) || ((size_t)st.st_size!=rfi_maplen))
+    return NULL;
+
+  return rfi_map;
+}
+
+// Tell the kernel how the pages holding a track's data will be used
+void rfi_advise(const RFI_Track *info, const int advice)
+{
+  unsigned long pagesize, start, end;
+
+  pagesize=sysconf(_SC_PAGESIZE);
+
+  // Advice must start on a page boundary
+  start=info->offset-(info->offset%pagesize);
+  end=info->offset+info->len;
+
+  if (end>rfi_maplen)
+    return;
+
+  madvise((void *)&rfi_map[start], end-start, advice);
+}
+
+// Load the index from the end of the file, if there is one, returns the number of tracks found
+int rfi_loadindex(FILE *rfifile)
+{
+  RFI_Track info;
+  unsigned char trailer[RFI_INDEXTRAILERLEN];
+  unsigned char entry[RFI_INDEXENTRYLEN];
+  long filelen, indexpos;
+  unsigned long count, n;
+
+  if (fseek(rfifile, 0, SEEK_END)!=0)
+    return 0;
+
+  filelen=ftell(rfifile);
+
+  if ((filelen<(long)(rfi_headerlen+3+RFI_INDEXTRAILERLEN)) || (fseek(rfifile, filelen-RFI_INDEXTRAILERLEN, SEEK_SET)!=0))
+    return 0;
+
+  if ((fread(trailer, sizeof(trailer), 1, rfifile)!=1) || (memcmp(&trailer[8], RFI_INDEXMAGIC, RFI_INDEXMAGICLEN)!=0))
+    return 0;
+
+  indexpos=byteorder_get64(trailer);
+
+  if ((indexpos<(long)(rfi_headerlen+3)) || (indexpos>=filelen) || (fseek(rfifile, indexpos, SEEK_SET)!=0))
+    return 0;
+
+  // The index looks like a track header with no track
+  if ((!rfi_readtrackheader(rfifile, &info)) || (info.track!=-1) || ((unsigned long)(filelen-info.offset)!=info.len))
+    return 0;
+
+  count=(info.len-RFI_INDEXTRAILERLEN)/RFI_INDEXENTRYLEN;
+
+  for (n=0; n<count; n++)
+  {
+    if (fread(entry, sizeof(entry), 1, rfifile)!=1)
+      break;
+
+    info.track=byteorder_get16(&entry[0]);
+    info.side=entry[2];
+    info.rpm=((float)byteorder_get32(&entry[4]))/100;
+    info.offset=byteorder_get64(&entry[8]);
+    info.len=byteorder_get32(&entry[16]);
+    info.crc=byteorder_get32(&entry[20]);
+    info.hascrc=1;
+    info.verified=0;
+
+    switch (entry[3])
+    {
+      case RFI_ENCRAW:
+        strcpy(info.encoding, "raw");
+        break;
+
+      case RFI_ENCRLE:
+        strcpy(info.encoding, "rle");
+        break;
+
+      default:
+        info.encoding[0]=0;
+        break;
+    }
+
+    // Only trust the index if every track in it fits within the file
+    if ((info.encoding[0]==0) || (info.len==0) || (info.offset<(long)(rfi_headerlen+3)) || ((info.offset+(long)info.len)>indexpos))
+      break;
+
+    if (!rfi_addtrack(&rfi_index, &rfi_indexlen, &rfi_indexsize, &info))
+      break;
+  }
+
+  // Don't use a partially read index, so the track headers are read instead
+  if (n<count)
+  {
+    rfi_freeindex();
+    return 0;
+  }
+
+  return rfi_indexlen;
+}
+
+// Read every track header once, recording where each track's data is, returns the number of tracks found
+int rfi_buildindex(FILE *rfifile)
+{
+  RFI_Track info;
+
+  rfi_freeindex();
+
+  // Use the index at the end of the file when there is one
+  if (rfi_loadindex(rfifile)>0)
+    return rfi_indexlen;
+
+  rfi_freeindex();
+
+  // Seek past file JSON metadata
+  if (fseek(rfifile, rfi_headerlen+3, SEEK_SET)!=0)
+    return 0;
+
+  while (rfi_readtrackheader(rfifile, &info))
+  {
+    // Only tracks with data can be read
+    if ((info.encoding[0]!=0) && (info.len!=0))
+    {
+      if (!rfi_addtrack(&rfi_index, &rfi_indexlen, &rfi_indexsize, &info))
+        break;
+    }
+
+    // Skip to the next track header
+    if (fseek(rfifile, info.offset+info.len, SEEK_SET)!=0)
+      break;
+  }
+
+  return rfi_indexlen;
+}
+
 int rfi_readheader(FILE *rfifile)
 {
   unsigned char buff[4];
@@ -148,6 +518,9 @@ int rfi_readheader(FILE *rfifile)
         free(tokens);
         free(rfi_headerstring);
 
+        rfi_buildindex(rfifile);
+        rfi_mapfile(rfifile);
+
         return 1;
       }
 
@@ -158,53 +531,54 @@ int rfi_readheader(FILE *rfifile)
   return 0;
 }
 
-// RLE encode raw binary sample data
-unsigned long rfi_rleencode(unsigned char *rlebuffer, const unsigned long maxrlelen, const unsigned char *rawtrackdata, const unsigned long rawdatalength)
+// RLE encode flux runs
+unsigned long rfi_rleencode(unsigned char *rlebuffer, const unsigned long maxrlelen, const Mod_Flux *flux)
 {
   unsigned long rlelen=0;
-  unsigned char c;
-  char state=0;
-  unsigned int i, j;
-  int count=0;
-
-  // Determine starting sample level
-  state=(rawtrackdata[0]&0x80)>>7;
+  unsigned long i;
+  unsigned long count=0;
+  unsigned long pos=0;
 
   // If not starting at zero, then record a 0 count
-  if (state!=0)
+  if (flux->level!=0)
     rlebuffer[rlelen++]=0;
 
-  for (i=0; i<rawdatalength; i++)
+  for (i=0; i<=flux->len; i++)
   {
-    c=rawtrackdata[i];
-
-    // Process each of the 8 sample bits looking for state change
-    for (j=0; j<8; j++)
+    if (i<flux->len)
     {
-      count++;
-
-      if (count>0xff)
+      // Look for extended runs
+      if (flux->runs[i]==0)
       {
-        // Check for RLE buffer overflow
-        if ((rlelen+2)>=maxrlelen) return 0;
-
-        rlebuffer[rlelen++]=0xff;
-        rlebuffer[rlelen++]=0;
-        count=0;
+        count+=MOD_FLUXEXTEND;
+        pos+=MOD_FLUXEXTEND;
+        continue;
       }
 
-      if (((c&0x80)>>7)!=state)
-      {
-        state=1-state;
+      count+=flux->runs[i];
+      pos+=flux->runs[i];
+    }
+    else
+      count+=(flux->samples-pos); // Samples following the last level change
 
-        // Check for RLE buffer overflow
-        if ((rlelen+1)>=maxrlelen) return 0;
+    // Runs longer than 0xff are split, with the sample that overflows the count being dropped
+    while (count>0xff)
+    {
+      // Check for RLE buffer overflow
+      if ((rlelen+2)>=maxrlelen) return 0;
 
-        rlebuffer[rlelen++]=count;
-        count=0;
-      }
+      rlebuffer[rlelen++]=0xff;
+      rlebuffer[rlelen++]=0;
+      count-=0x100;
+    }
 
-      c=c<<1;
+    if (i<flux->len)
+    {
+      // Check for RLE buffer overflow
+      if ((rlelen+1)>=maxrlelen) return 0;
+
+      rlebuffer[rlelen++]=count;
+      count=0;
     }
   }
 
@@ -212,15 +586,31 @@ unsigned long rfi_rleencode(unsigned char *rlebuffer, const unsigned long maxrle
 }
 
 // Write track metadata and track sample data
-void rfi_writetrack(FILE *rfifile, const int track, const int side, const float rpm, const char *encoding, const unsigned char *rawtrackdata, const unsigned long rawdatalength)
+void rfi_writetrack(FILE *rfifile, const int track, const int side, const float rpm, const char *encoding, const unsigned char *rawtrackdata, const unsigned long rawdatalength, const Mod_Flux *flux)
 {
+  RFI_Track info;
+
   if (rfifile==NULL) return;
 
   fprintf(rfifile, "{track:%d,side:%d,rpm:%.2f,", track, side, rpm);
 
+  // Keep track of where the data is for the index
+  info.track=track;
+  info.side=side;
+  info.rpm=rpm;
+  info.encoding[0]=0;
+  info.hascrc=1;
+  info.verified=0;
+
   if (strstr(encoding, "raw")!=NULL)
   {
     fprintf(rfifile, "enc:\"%s\",len:%lu}", encoding, rawdatalength);
+
+    info.offset=ftell(rfifile);
+    info.len=rawdatalength;
+    info.crc=calc_crc32(rawtrackdata, rawdatalength, 0);
+    strcpy(info.encoding, "raw");
+
     fwrite(rawtrackdata, 1, rawdatalength, rfifile);
   }
   else
@@ -233,9 +623,15 @@ void rfi_writetrack(FILE *rfifile, const int track, const int side, const float
 
     if (rledata!=NULL)
     {
-      rledatalength=rfi_rleencode(rledata, rawdatalength, rawtrackdata, rawdatalength);
+      rledatalength=rfi_rleencode(rledata, rawdatalength, flux);
 
       fprintf(rfifile, "enc:\"%s\",len:%lu}", encoding, rledatalength);
+
+      info.offset=ftell(rfifile);
+      info.len=rledatalength;
+      info.crc=calc_crc32(rledata, rledatalength, 0);
+      strcpy(info.encoding, "rle");
+
       fwrite(rledata, 1, rledatalength, rfifile);
 
       free(rledata);
@@ -250,219 +646,294 @@ void rfi_writetrack(FILE *rfifile, const int track, const int side, const float
     // Don't write any track data for unknown encodings
     fprintf(rfifile, "enc:\"unknown\",len:0}");
   }
+
+  if ((info.encoding[0]!=0) && (info.len!=0))
+    rfi_addtrack(&rfi_written, &rfi_writtenlen, &rfi_writtensize, &info);
 }
 
-long rfi_readtrack(FILE *rfifile, const int track, const int side, char* buf, const uint32_t buflen)
+// Write the index of tracks to the end of the file, once all the tracks have been written
+void rfi_finalise(FILE *rfifile)
 {
-  int rfi_track = -1;
-  int rfi_side = -1;
-  float rfi_rpm = -1;
-  char rfi_trackencoding[10];
-  unsigned long rfi_trackdatalen = 0;
+  long indexpos;
+  unsigned int i;
 
-  char metabuffer[1024];
+  if (rfifile==NULL) return;
 
-  if (rfifile==NULL) return 0;
+  indexpos=ftell(rfifile);
 
-  // Make sure we have valid file JSON metadata
-  if (rfi_headerlen==0) return 0;
+  fprintf(rfifile, "{index:%u,len:%lu}", rfi_writtenlen, ((unsigned long)rfi_writtenlen*RFI_INDEXENTRYLEN)+RFI_INDEXTRAILERLEN);
 
-  // Seek past file JSON metadata
-  if (fseek(rfifile, rfi_headerlen+3, SEEK_SET)!=0)
-    return 0;
+  for (i=0; i<rfi_writtenlen; i++)
+  {
+    byteorder_put16(rfifile, rfi_written[i].track);
+    fputc(rfi_written[i].side, rfifile);
+    fputc((strcmp(rfi_written[i].encoding, "raw")==0)?RFI_ENCRAW:RFI_ENCRLE, rfifile);
+    byteorder_put32(rfifile, (uint32_t)((rfi_written[i].rpm*100)+0.5));
+    byteorder_put64(rfifile, rfi_written[i].offset);
+    byteorder_put32(rfifile, rfi_written[i].len);
+    byteorder_put32(rfifile, rfi_written[i].crc);
+  }
 
-  while (!feof(rfifile))
+  byteorder_put64(rfifile, indexpos);
+  fwrite(RFI_INDEXMAGIC, 1, RFI_INDEXMAGICLEN, rfifile);
+
+  if (rfi_written!=NULL)
+    free(rfi_written);
+
+  rfi_written=NULL;
+  rfi_writtenlen=0;
+  rfi_writtensize=0;
+}
+
+// Find a track in the index
+RFI_Track *rfi_findtrack(const int track, const int side)
+{
+  unsigned int i;
+
+  for (i=0; i<rfi_indexlen; i++)
   {
-    jsmn_parser parser;
-    int numtokens;
-    long metapos;
-    int i;
-
-    // Initialise track metadata
-    rfi_track=-1;
-    rfi_side=-1;
-    rfi_rpm=-1;
-    rfi_trackencoding[0]=0;
-    rfi_trackdatalen=0;
-
-    // Read track metadata
-    metapos=ftell(rfifile);
-
-    if (metapos==-1)
-      return 0;
+    if ((rfi_index[i].track==track) && (rfi_index[i].side==side))
+      return &rfi_index[i];
+  }
 
-    if (fread(metabuffer, sizeof(metabuffer), 1, rfifile)!=1)
-      return 0;
+  return NULL;
+}
 
-    if (fseek(rfifile, metapos, SEEK_SET)!=0)
-      return 0;
+// Check if the track has a CRC in the index which hasn't been checked yet
+int rfi_needscrc(const RFI_Track *info)
+{
+  return ((info->hascrc) && (!info->verified));
+}
+
+// Warn if the track data read doesn't match the CRC from the index
+void rfi_checkcrc(RFI_Track *info, const unsigned long crc)
+{
+  info->verified=1;
+
+  if ((info->hascrc) && (crc!=info->crc))
+    fprintf(stderr, "RFI track %d side %d data doesn't match CRC in index (%.8lx != %.8lx)\n", info->track, info->side, crc, info->crc);
+}
+
+// Expand a block of RLE track data into samples, carrying on from where the last block left off
+//   each run length is expanded in one go, finishing any partly filled byte, then filling whole bytes, then starting the next byte
+void rfi_rledecode(RFI_RLEState *state, const unsigned char *rledata, const unsigned long rlelen, char *buf, const uint32_t buflen)
+{
+  unsigned long i, bytes;
+  unsigned int c, n;
+
+  if (state->rlen>=buflen) return;
+
+  for (i=0; i<rlelen; i++)
+  {
+    // Extract next RLE value
+    c=rledata[i];
 
-    for (i=0; i<(int)sizeof(metabuffer); i++)
+    // Finish off the partly filled byte
+    if ((state->blen>0) && (c>0))
     {
-      if ((metabuffer[i]=='}') && ((i+1)<(int)sizeof(metabuffer)))
+      n=BITSPERBYTE-state->blen;
+      if (n>c) n=c;
+
+      state->b=(state->b<<n)|(state->s?((1<<n)-1):0);
+      state->blen+=n;
+      c-=n;
+
+      if (state->blen==BITSPERBYTE)
       {
-        metabuffer[i+1]=0;
-        break;
+        buf[state->rlen++]=state->b;
+
+        // Check for unpacking overflow
+        if (state->rlen>=buflen)
+          return;
+
+        state->b=0;
+        state->blen=0;
       }
     }
 
-    // Quick check for validty and to count the tokens
-    jsmn_init(&parser);
-    numtokens=jsmn_parse(&parser, metabuffer, sizeof(metabuffer), NULL, 0);
-
-    if (numtokens>0)
+    // Fill whole bytes at this level
+    if (c>=BITSPERBYTE)
     {
-      jsmntok_t *tokens;
+      bytes=c/BITSPERBYTE;
+      if (bytes>(unsigned long)(buflen-state->rlen))
+        bytes=buflen-state->rlen;
 
-      tokens=malloc(numtokens*sizeof(jsmntok_t));
+      memset(&buf[state->rlen], state->s?0xff:0x00, bytes);
+      state->rlen+=bytes;
+      c-=(bytes*BITSPERBYTE);
 
-      if (tokens==NULL) return 0;
+      // Check for unpacking overflow
+      if (state->rlen>=buflen)
+        return;
+    }
 
-      jsmn_init(&parser);
-      numtokens=jsmn_parse(&parser, metabuffer, sizeof(metabuffer), tokens, numtokens);
+    // Start the next byte with what is left, the byte is empty when anything is left
+    if (c>0)
+    {
+      state->b=(state->s?((1<<c)-1):0);
+      state->blen=c;
+    }
 
-      // Move file pointer to first byte after track header
-      if (fseek(rfifile, tokens[0].end, SEEK_CUR)!=0)
-      {
-        free(tokens);
-        return 0;
-      }
+    // Switch states
+    state->s=1-state->s;
+  }
+}
 
-      for (i=0; i<numtokens; i++)
-      {
-        char rfic;
+// Get track data from the mapped file, letting the kernel know how it will be used
+const unsigned char *rfi_usemappedtrack(const unsigned char *map, const RFI_Track *info)
+{
+  const RFI_Track *next;
 
-        if ((tokens[i].type==JSMN_PRIMITIVE) && (tokens[i].size==1) && ((i+1)<=numtokens))
-        {
-          if (strncmp(&metabuffer[tokens[i].start], "enc", tokens[i].end-tokens[i].start)==0)
-          {
-            rfic=metabuffer[tokens[i+1].end];
-            metabuffer[tokens[i+1].end]=0;
+  // Data for this track is read once from start to end, and the next track in the file is likely to be wanted next
+  rfi_advise(info, MADV_SEQUENTIAL);
 
-            if (strlen(&metabuffer[tokens[i+1].start])<sizeof(rfi_trackencoding))
-              strcpy(rfi_trackencoding, &metabuffer[tokens[i+1].start]);
+  next=info+1;
+  if (next<&rfi_index[rfi_indexlen])
+    rfi_advise(next, MADV_WILLNEED);
 
-            metabuffer[tokens[i+1].end]=rfic;
-          }
-          else
-          if (strncmp(&metabuffer[tokens[i].start], "track", tokens[i].end-tokens[i].start)==0)
-          {
-            rfic=metabuffer[tokens[i+1].end];
-            metabuffer[tokens[i+1].end]=0;
+  return &map[info->offset];
+}
 
-            sscanf(&metabuffer[tokens[i+1].start], "%3d", &rfi_track);
+// Read track data straight from the mapped file
+long rfi_readmappedtrack(const unsigned char *map, RFI_Track *info, char* buf, const uint32_t buflen)
+{
+  const unsigned char *data;
 
-            metabuffer[tokens[i+1].end]=rfic;
-          }
-          else
-          if (strncmp(&metabuffer[tokens[i].start], "side", tokens[i].end-tokens[i].start)==0)
-          {
-            rfic=metabuffer[tokens[i+1].end];
-            metabuffer[tokens[i+1].end]=0;
+  data=rfi_usemappedtrack(map, info);
 
-            sscanf(&metabuffer[tokens[i+1].start], "%1d", &rfi_side);
+  if (rfi_needscrc(info))
+    rfi_checkcrc(info, calc_crc32(data, info->len, 0));
 
-            metabuffer[tokens[i+1].end]=rfic;
-          }
-          else
-          if (strncmp(&metabuffer[tokens[i].start], "len", tokens[i].end-tokens[i].start)==0)
-          {
-            rfic=metabuffer[tokens[i+1].end];
-            metabuffer[tokens[i+1].end]=0;
+  if (strstr(info->encoding, "raw")!=NULL)
+  {
+    if (info->len<=buflen)
+    {
+      memcpy(buf, data, info->len);
 
-            sscanf(&metabuffer[tokens[i+1].start], "%8lu", &rfi_trackdatalen);
+      return info->len;
+    }
+    else
+    {
+      memcpy(buf, data, buflen);
 
-            metabuffer[tokens[i+1].end]=rfic;
-          }
-        }
-      }
+      return buflen;
+    }
+  }
+  else
+  if (strstr(info->encoding, "rle")!=NULL)
+  {
+    RFI_RLEState state;
 
-      free(tokens);
-      tokens=NULL;
+    memset(&state, 0, sizeof(state));
 
-      // Is this the track we want?
-      if ((rfi_track==track) && (rfi_side==side) && (rfi_trackencoding[0]!=0) && (rfi_trackdatalen!=0))
-      {
-        if (strstr(rfi_trackencoding, "raw")!=NULL)
-        {
-          if (rfi_trackdatalen<=buflen)
-          {
-            fread(buf, rfi_trackdatalen, 1, rfifile);
+    rfi_rledecode(&state, data, info->len, buf, buflen);
 
-            return rfi_trackdatalen;
-          }
-          else
-          {
-            fread(buf, buflen, 1, rfifile);
+    return state.rlen;
+  }
 
-            return buflen;
-          }
-        }
-        else
-        if (strstr(rfi_trackencoding, "rle")!=NULL)
-        {
-          unsigned char c, b, blen, s;
-          long rlen=0;
-          char *rlebuff;
+  return 0;
+}
+
+long rfi_readtrack(FILE *rfifile, const int track, const int side, char* buf, const uint32_t buflen)
+{
+  RFI_Track *info;
+  const unsigned char *map;
+
+  if (rfifile==NULL) return 0;
 
-          rlebuff=malloc(rfi_trackdatalen);
+  // Make sure we have valid file JSON metadata
+  if (rfi_headerlen==0) return 0;
 
-          if (rlebuff==NULL) return 0;
+  info=rfi_findtrack(track, side);
+  if (info==NULL) return 0;
 
-          blen=0; s=0;
-          fread(rlebuff, rfi_trackdatalen, 1, rfifile);
+  // Decode in place when the file is mapped, and the track data is all within it
+  map=rfi_getmap(rfifile);
+  if ((map!=NULL) && (((unsigned long)info->offset+info->len)<=rfi_maplen))
+    return rfi_readmappedtrack(map, info, buf, buflen);
 
-          for (i=0; (unsigned int)i<rfi_trackdatalen; i++)
-          {
-            // Extract next RLE value
-            c=rlebuff[i];
+  // Go straight to the track data
+  if (fseek(rfifile, info->offset, SEEK_SET)!=0)
+    return 0;
 
-            while (c>0)
-            {
-              b=(b<<1)|s;
-              blen++;
+  if (strstr(info->encoding, "raw")!=NULL)
+  {
+    if (info->len<=buflen)
+    {
+      if ((fread(buf, info->len, 1, rfifile)==1) && (rfi_needscrc(info)))
+        rfi_checkcrc(info, calc_crc32((unsigned char *)buf, info->len, 0));
 
-              if (blen==8)
-              {
-                buf[rlen++]=b;
+      return info->len;
+    }
+    else
+    {
+      fread(buf, buflen, 1, rfifile);
 
-                // Check for unpacking overflow
-                if (rlen>=buflen)
-                {
-                  free(rlebuff);
-                  return rlen;
-                }
+      return buflen;
+    }
+  }
+  else
+  if (strstr(info->encoding, "rle")!=NULL)
+  {
+    RFI_RLEState state;
+    unsigned long rlepos, rlelen;
+    unsigned long crc=0;
+    unsigned char rlebuff[RFI_RLEBLOCK];
 
-                b=0;
-                blen=0;
-              }
+    memset(&state, 0, sizeof(state));
 
-              c--;
-            }
+    // Decode a block at a time, so no memory is needed for the whole track
+    for (rlepos=0; rlepos<info->len; rlepos+=rlelen)
+    {
+      rlelen=info->len-rlepos;
+      if (rlelen>sizeof(rlebuff))
+        rlelen=sizeof(rlebuff);
 
-            // Switch states
-            s=1-s;
-          }
+      if (fread(rlebuff, rlelen, 1, rfifile)!=1)
+        break;
 
-          free(rlebuff);
+      if (rfi_needscrc(info))
+        crc=calc_crc32(rlebuff, rlelen, crc);
 
-          return rlen;
-        }
-      }
-      else
-      {
-        // If the currently read track is more than the one we want, then the track isn't here
-        if (rfi_track>track) return 0;
+      rfi_rledecode(&state, rlebuff, rlelen, buf, buflen);
 
-        // Skip this track, it's not the one we want
-        if (fseek(rfifile, rfi_trackdatalen, SEEK_CUR)!=0)
-          return 0;
-      }
+      if (state.rlen>=buflen)
+        return state.rlen;
     }
-    else // No tokens found, give up further processing
-      return 0;
+
+    if ((rlepos==info->len) && (rfi_needscrc(info)))
+      rfi_checkcrc(info, crc);
+
+    return state.rlen;
   }
 
   return 0;
 }
 
+// Get the run lengths of an RLE encoded track from the mapped file, so they can be used without expanding them into samples
+//   returns NULL when the track isn't RLE encoded or the file isn't mapped, the data is only valid until the file is unmapped
+const unsigned char *rfi_trackrle(FILE *rfifile, const int track, const int side, unsigned long *rlelen)
+{
+  RFI_Track *info;
+  const unsigned char *map;
+  const unsigned char *data;
+
+  if ((rfifile==NULL) || (rfi_headerlen==0)) return NULL;
+
+  info=rfi_findtrack(track, side);
+  if ((info==NULL) || (strstr(info->encoding, "rle")==NULL))
+    return NULL;
+
+  map=rfi_getmap(rfifile);
+  if ((map==NULL) || (((unsigned long)info->offset+info->len)>rfi_maplen))
+    return NULL;
+
+  data=rfi_usemappedtrack(map, info);
+
+  if (rfi_needscrc(info))
+    rfi_checkcrc(info, calc_crc32(data, info->len, 0));
+
+  *rlelen=info->len;
+
+  return data;
+}
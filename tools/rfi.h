@@ -4,6 +4,8 @@
 #include <stdio.h>
 #include <stdint.h>
 
+#include "mod.h"
+
 /*
 
 RFI - Raw Flux Image
@@ -39,10 +41,62 @@ RLE encoding
 * runs are samples between level changes
 * multiple rotations should be stored incase of jacket slip or CAV fluctuations
 
+Index (optional, after the last track)
+=====
+JSON index metadata .. {index:160,len:3852}
+* index is the number of tracks listed
+* len is the length of the binary data which follows, so readers which don't know about the index skip it like a track
+* for each track (little endian)
+  track: 2 bytes
+  side: 1 byte
+  enc: 1 byte, 1 for "raw" or 2 for "rle"
+  rpm: 4 bytes, rpm x 100
+  offset: 8 bytes, from the start of the file to the track data
+  len: 4 bytes, of the track data
+  crc: 4 bytes, CRC32 of the track data
+* finally, as the last 12 bytes of the file
+  offset: 8 bytes, from the start of the file to the JSON index metadata
+  magic: 4 bytes "RFIX"
+* readers use the index to find tracks without reading every track header, and to check track data is intact
+
 */
 
 #define RFI_MAGIC "RFI"
 
+// Index of tracks at the end of the file
+#define RFI_INDEXMAGIC "RFIX"
+#define RFI_INDEXMAGICLEN 4
+#define RFI_INDEXENTRYLEN (2+1+1+4+8+4+4)
+#define RFI_INDEXTRAILERLEN (8+RFI_INDEXMAGICLEN)
+
+// Track encodings in the index
+#define RFI_ENCUNKNOWN 0
+#define RFI_ENCRAW 1
+#define RFI_ENCRLE 2
+
+// Where a track is in the file, so it can be read without parsing the headers before it
+typedef struct RFITrack
+{
+  int track;
+  int side;
+  float rpm;
+  char encoding[10];
+  long offset; // Of the track data
+  unsigned long len; // Of the encoded track data
+  int hascrc;
+  unsigned long crc; // CRC32 of the encoded track data
+  int verified; // Set once the CRC has been checked, so each track is only checked once
+} RFI_Track;
+
+// Where RLE decoding has got to, so track data can be decoded in blocks
+typedef struct RFIRLEState
+{
+  unsigned char b; // Sample bits collected so far
+  unsigned char blen; // Number of bits in b
+  unsigned char s; // Current sample level
+  long rlen; // Bytes of samples written
+} RFI_RLEState;
+
 // From RFI header JSON
 extern int rfi_tracks;
 extern int rfi_sides;
@@ -52,7 +106,11 @@ extern unsigned char rfi_writeable;
 // Library functions
 extern int rfi_readheader(FILE *rfifile);
 extern void rfi_writeheader(FILE *rfifile, const int tracks, const int sides, const long rate, const unsigned char writeable);
-extern void rfi_writetrack(FILE *rfifile, const int track, const int side, const float rpm, const char *encoding, const unsigned char *rawtrackdata, const unsigned long rawdatalength);
+extern void rfi_writetrack(FILE *rfifile, const int track, const int side, const float rpm, const char *encoding, const unsigned char *rawtrackdata, const unsigned long rawdatalength, const Mod_Flux *flux);
 extern long rfi_readtrack(FILE *rfifile, const int track, const int side, char* buf, const uint32_t buflen);
+extern const unsigned char *rfi_trackrle(FILE *rfifile, const int track, const int side, unsigned long *rlelen);
+extern void rfi_finalise(FILE *rfifile);
+extern void rfi_freeindex();
+extern void rfi_unmap();
 
 #endif
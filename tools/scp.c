@@ -325,7 +325,7 @@ void scp_writeheader(FILE *scpfile, const uint8_t rotations, const uint8_t start
     fprintf(scpfile, "%c%c%c%c", 0, 0, 0, 0);
 }
 
-void scp_writetrack(FILE *scpfile, const uint8_t track, const unsigned char *rawtrackdata, const unsigned long rawdatalength, const uint8_t rotations, const float rpm)
+void scp_writetrack(FILE *scpfile, const uint8_t track, const Mod_Flux *flux, const uint8_t rotations, const float rpm)
 {
   long scppos;
   long scpdatapos;
@@ -333,9 +333,10 @@ void scp_writetrack(FILE *scpfile, const uint8_t track, const unsigned char *raw
   uint8_t i;
   uint16_t fluxtime;
   uint32_t numfluxes;
-  unsigned char c,j;
-  char level,bi=0;
-  unsigned long fluxdatapos;
+  unsigned char level;
+  unsigned long run;
+  unsigned long edgepos, lastedgepos, fluxpos;
+  unsigned long rawdatalength;
   float celltime;
   uint32_t value;
   unsigned long rotpoint;
@@ -355,6 +356,7 @@ void scp_writetrack(FILE *scpfile, const uint8_t track, const unsigned char *raw
   // Write the track header
   fwrite(&tdh, 1, sizeof(tdh), scpfile);
 
+  rawdatalength=flux->samples/BITSPERBYTE;
   rotpoint=rawdatalength/rotations;
 
   // Write track timings
@@ -372,62 +374,64 @@ void scp_writetrack(FILE *scpfile, const uint8_t track, const unsigned char *raw
     fwrite(&timings, 1, sizeof(timings), scpfile);
   }
 
-  // Split raw data into rotations
+  // Set up the sampler
+  level=flux->level;
+  run=0;
+  fluxpos=0;
+  edgepos=0;
+
+  // Split flux into rotations
   for (i=0; i<rotations; i++)
   {
     // 16 bit big-endian time in nanoseconds/25 between fluxes
-    level=(rawtrackdata[rotpoint*i]&0x80)>>7;
-    bi=level;
-    fluxtime=0;
+    lastedgepos=(rotpoint*i)*BITSPERBYTE;
     numfluxes=0;
 
     scpdatapos=ftell(scpfile);
     value=(uint32_t) scpdatapos;
 
-    // Process each byte of the raw flux data
-    for (fluxdatapos=(rotpoint*i); ((fluxdatapos<rotpoint*(i+1)) && (fluxdatapos<rawdatalength)); fluxdatapos++)
+    // Process each rising edge within this rotation
+    while (1)
     {
-      // Extract byte from buffer
-      c=rawtrackdata[fluxdatapos];
-
-      // Process each bit of the extracted byte
-      for (j=0; j<BITSPERBYTE; j++)
+      // Find the next rising edge, if not already found in the previous rotation
+      while ((edgepos<=lastedgepos) && (run<flux->len))
       {
-        // Determine next level
-        bi=((c&0x80)>>7);
+        // Look for extended runs
+        if (flux->runs[run]==0)
+        {
+          fluxpos+=MOD_FLUXEXTEND;
+          run++;
+          continue;
+        }
 
-        // Increment samples counter
-        fluxtime++;
+        fluxpos+=flux->runs[run++];
+        level=1-level;
 
-        // Look for level changes
-        if (bi!=level)
-        {
-          // Flip level cache
-          level=1-level;
+        // Look for rising edge, as sample position
+        if (level==1)
+          edgepos=fluxpos-1;
+      }
 
-          // Look for rising edge
-          if (level==1)
-          {
-            // Increment total number of fluxes
-            numfluxes++;
+      // Stop at the end of the rotation, or the end of the raw data
+      if ((edgepos<=lastedgepos) || (edgepos>=((rotpoint*(i+1))*BITSPERBYTE)) || (edgepos>=(rawdatalength*BITSPERBYTE)))
+        break;
 
-            // Convert samples into nanoseconds/25
-            celltime=(mod_samplestoms(fluxtime)*NSINUS)/SCP_BASE_NS;
+      // Increment total number of fluxes
+      numfluxes++;
 
-            // Convert back from float to uint16_t
-            fluxtime=roundf(celltime);
+      // Count samples since previous flux, or since the start of the rotation
+      fluxtime=edgepos-lastedgepos;
+      if (numfluxes==1) fluxtime++;
+      lastedgepos=edgepos;
 
-            // Write sample between fluxes
-            fprintf(scpfile, "%c%c", (fluxtime>>8)&0xff, fluxtime&0xff);
+      // Convert samples into nanoseconds/25
+      celltime=(mod_samplestoms(fluxtime)*NSINUS)/SCP_BASE_NS;
 
-            // Reset samples counter
-            fluxtime=0;
-          }
-        }
+      // Convert back from float to uint16_t
+      fluxtime=roundf(celltime);
 
-        // Move on to next sample level (bit)
-        c=c<<1;
-      }
+      // Write sample between fluxes
+      fprintf(scpfile, "%c%c", (fluxtime>>8)&0xff, fluxtime&0xff);
     }
 
     // Store where we are
@@ -1,6 +1,8 @@
 #ifndef _SCP_H_
 #define _SCP_H_
 
+#include "mod.h"
+
 #define SCP_MAGIC "SCP"
 #define SCP_VERSION 0x22
 
@@ -120,7 +122,7 @@ struct scp_timings
 
 extern void scp_writeheader(FILE *scpfile, const uint8_t rotations, const uint8_t starttrack, const uint8_t endtrack, const float rpm, const uint8_t sides);
 
-extern void scp_writetrack(FILE *scpfile, const uint8_t track, const unsigned char *rawtrackdata, const unsigned long rawdatalength, const uint8_t rotations, const float rpm);
+extern void scp_writetrack(FILE *scpfile, const uint8_t track, const Mod_Flux *flux, const uint8_t rotations, const float rpm);
 
 extern void scp_finalise(FILE *scpfile, const uint8_t endtrack);
 